@@ -0,0 +1,205 @@
+#include "bench.h"
+#include "search.h"
+#include "transposition_table.h"
+#include <fstream>
+#include <cstring>
+
+const std::string benchPositions[] = {
+    STARTING_FEN,
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+};
+
+const int benchPositionCount = sizeof(benchPositions) / sizeof(benchPositions[0]);
+
+size_t bench(int depth, size_t nodes) {
+    size_t totalNodes = 0;
+    int64_t elapsed = 0; // only the searches, clearing the tables is not search speed
+
+    for (int i = 0; i < benchPositionCount; i++) {
+        std::cout << "Position " << (i + 1) << "/" << benchPositionCount << ": " << benchPositions[i] << std::endl;
+
+        // every position starts from an empty table so the result does not depend on the order
+        transpositionTable.clear();
+        clearRepetitions();
+        clearSearchThreads();
+
+        SearchLimits limits;
+        limits.depth = nodes ? MAX_PLY : depth;
+        limits.nodes = nodes;
+
+        ChessBoard board = createBoardFromFen(benchPositions[i]);
+        auto start = std::chrono::steady_clock::now();
+        totalNodes += search(board, limits, 1);
+        elapsed += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    elapsed /= 1000;
+
+    std::cout << std::endl << "===========================" << std::endl;
+    std::cout << "Total time (ms) : " << elapsed << std::endl;
+    std::cout << "Nodes searched  : " << totalNodes << std::endl;
+    std::cout << "Nodes/second    : " << (totalNodes * 1000) / (elapsed + 1) << std::endl;
+    std::cout << "Signature       : " << totalNodes << std::endl;
+
+    return totalNodes;
+}
+
+bool perftSuite(const std::string &file, int maxDepth, int numThreads) {
+    std::ifstream epd(file);
+    if (!epd.is_open()) {
+        std::cout << "Unable to open perft suite: " << file << std::endl;
+        return false;
+    }
+
+    logInfo("Running perft suite", file);
+
+    int passed = 0, failed = 0;
+
+    // both slider indexings against the ray by ray attacks, the suite itself runs with the selected one
+    bool pext = sliderIndexingUsesPext();
+    for (bool backend : {false, true}) {
+        if (setSliderIndexing(backend) != backend) continue;
+
+        bool matches = checkSliderAttacks();
+        std::cout << "Slider attacks (" << (backend ? "pext" : "magics") << "): " << (matches ? "ok" : "FAIL") << std::endl;
+        matches ? passed++ : failed++;
+    }
+    setSliderIndexing(pext);
+
+    U64 totalNodes = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::string line;
+    while (std::getline(epd, line)) {
+        size_t split = line.find(';');
+        if (line.empty() || line[0] == '#' || split == std::string::npos) continue;
+
+        std::string fen = line.substr(0, split);
+        ChessBoard board = createBoardFromFen(fen);
+
+        // the rest of the line is ";D1 20 ;D2 400 ..."
+        std::istringstream fields(line.substr(split));
+        std::string field;
+        U64 expected;
+        while (fields >> field >> expected) {
+            int depth = std::stoi(field.substr(2));
+            if (maxDepth > 0 && depth > maxDepth) continue;
+
+            U64 nodes = perft(board, depth, numThreads, false);
+            totalNodes += nodes;
+
+            if (nodes == expected) {
+                passed++;
+            } else {
+                failed++;
+                std::cout << "FAIL " << fen << " depth " << depth << " expected " << expected << " got " << nodes << std::endl;
+            }
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Passed " << passed << "/" << (passed + failed)
+              << " nodes " << totalNodes
+              << " time " << elapsed
+              << " nps " << (totalNodes * 1000) / (elapsed + 1) << std::endl;
+
+    return failed == 0;
+}
+
+struct NNUECheckResult {
+    U64 nodes = 0;
+    U64 accumulatorErrors = 0;
+    U64 outputErrors = 0;
+    int64_t checksum = 0; // keeps the timed evaluations from being optimised away
+};
+
+static void nnueWalk(ChessBoard &board, int depth, bool verify, NNUECheckResult &result) {
+    result.nodes++;
+
+    if (board.accumulator) {
+        int score = nnueOutput(*board.accumulator, board.white_to_move);
+        result.checksum += score;
+
+        if (verify) {
+            Accumulator fresh;
+            refreshAccumulator(board, fresh);
+            if (std::memcmp(fresh.values, board.accumulator->values, sizeof(fresh.values)) != 0) {
+                result.accumulatorErrors++;
+            }
+            if (score != nnueOutputScalar(*board.accumulator, board.white_to_move)) {
+                result.outputErrors++;
+            }
+        }
+    } else {
+        result.checksum += evaluate(board);
+    }
+
+    if (depth == 0) return;
+
+    Moves moves;
+    generateMoves(board, moves);
+    for (int i = 0; i < moves.count; i++) {
+        UndoInfo undo;
+        makeMove(board, moves.list[i], undo);
+        nnueWalk(board, depth - 1, verify, result);
+        unmakeMove(board, moves.list[i], undo);
+    }
+}
+
+bool nnueCheck(int depth) {
+    bool randomised = !networkLoaded;
+    if (randomised) {
+        std::cout << "No network loaded, checking with a random one" << std::endl;
+        randomNetwork(0x5EED);
+    }
+    std::cout << "Kernels: " << nnueKernelName() << std::endl;
+
+    std::unique_ptr<Accumulator[]> stack(new Accumulator[depth + 1]);
+    NNUECheckResult verified, incremental, classical;
+    int64_t incrementalMs = 0, classicalMs = 0;
+
+    for (const std::string &fen : benchPositions) {
+        ChessBoard board = createBoardFromFen(fen);
+
+        board.accumulator = stack.get();
+        refreshAccumulator(board, *board.accumulator);
+        nnueWalk(board, depth, true, verified);
+
+        auto start = std::chrono::steady_clock::now();
+        nnueWalk(board, depth, false, incremental);
+        incrementalMs += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+        board.accumulator = nullptr;
+        start = std::chrono::steady_clock::now();
+        nnueWalk(board, depth, false, classical);
+        classicalMs += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    if (randomised) {
+        networkLoaded = false;
+    }
+
+    bool passed = verified.accumulatorErrors == 0 && verified.outputErrors == 0;
+    std::cout << "Nodes checked   : " << verified.nodes << std::endl;
+    std::cout << "Accumulator errs: " << verified.accumulatorErrors << std::endl;
+    std::cout << "Output errors   : " << verified.outputErrors << std::endl;
+    std::cout << "NNUE nodes/sec  : " << (incremental.nodes * 1000) / (incrementalMs + 1) << std::endl;
+    std::cout << "HCE nodes/sec   : " << (classical.nodes * 1000) / (classicalMs + 1) << std::endl;
+    std::cout << (passed ? "NNUE check passed" : "NNUE check FAILED")
+              << " (checksum " << incremental.checksum + classical.checksum << ")" << std::endl;
+
+    return passed;
+}
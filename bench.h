@@ -0,0 +1,32 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include "engine.h"
+
+constexpr int BENCH_DEFAULT_DEPTH = 5;
+
+// the positions bench searches, also the corpus of the micro benchmarks
+extern const std::string benchPositions[];
+extern const int benchPositionCount;
+
+// Searches a fixed set of positions and prints the total nodes, time and nps.
+// The node count is the bench signature, any change to the search will alter it.
+// With nodes > 0 every position is searched to that node budget instead of depth.
+size_t bench(int depth, size_t nodes = 0);
+
+// Checks every position of an EPD file with ";D<depth> <nodes>" fields against perft,
+// depths above maxDepth are skipped (0 = check all). The slider tables of every indexing
+// the build supports are checked first. Returns true when all pass.
+bool perftSuite(const std::string &file, int maxDepth, int numThreads);
+
+constexpr int NNUE_CHECK_DEFAULT_DEPTH = 3;
+
+// Walks every bench position to depth with makeMove / unmakeMove and checks at each node
+// that the incrementally updated accumulator equals a fresh one and that the vectorised
+// output matches the scalar one, then times the walk with nnue and with the hand written
+// evaluation at every node. Without a loaded network a random one is used for the duration.
+// Returns true when every node matched.
+bool nnueCheck(int depth);
+
+#endif
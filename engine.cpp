@@ -10,11 +10,6 @@
         ['p'] = p, ['n'] = n, ['b'] = b, ['r'] = r, ['q'] = q, ['k'] = k,
     };
 
-U64 piece_keys[12][64];
-U64 castling_keys[16];
-U64 enpassant_keys[65];
-U64 side_key;
-
 void initOccupancies(ChessBoard &board) {
     board.occupancies[white] = 0ULL;
     board.occupancies[black] = 0ULL;
@@ -38,26 +33,14 @@ void initOccupancies(ChessBoard &board) {
     board.occupancies[both] = board.occupancies[white] | board.occupancies[black];
 }
 
-void initZobristKeys() {
-    writeToLogFile("Initializing Zobrist keys");
-    std::mt19937_64 rng(std::random_device{}());
-    std::uniform_int_distribution<uint64_t> dist;
-
-    for (size_t pt = 0; pt < 12; ++pt) {
-        for (size_t sq = 0; sq < 64; ++sq) {
-            piece_keys[pt][sq] = dist(rng);
-        }
-    }
-
-    for (size_t cr = 0; cr < 16; ++cr) {
-        castling_keys[cr] = dist(rng);
-    }
+void initEngine() {
+    auto start = std::chrono::steady_clock::now();
 
-    for (size_t square = 0; square < 65; ++square) {
-        enpassant_keys[square] = dist(rng);
-    }
+    initAttackTables();
+    initEvaluationTables();
 
-    side_key = dist(rng);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    logInfo("Tables initialized in", elapsed / 1000.0, "ms");
 }
 
 U64 zobristHash(const ChessBoard &board) {
@@ -85,12 +68,10 @@ U64 zobristHash(const ChessBoard &board) {
 
 
 ChessBoard createBoardFromFen(const std::string& fen) {
-    initAttackTables();
-    initZobristKeys();
-
-    writeToLogFile("Creating board with FEN: ", fen);
+    logDebug("Creating board with FEN:", fen);
 
     ChessBoard board = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    std::fill(std::begin(board.mailbox), std::end(board.mailbox), no_piece);
     std::istringstream fenStream(fen);
     std::string boardState;
     fenStream >> boardState;
@@ -102,6 +83,7 @@ ChessBoard createBoardFromFen(const std::string& fen) {
         } else if (c != '/') {
             int piece = char_pieces[c];
             board.bitboards[piece] |= 1ULL << position;
+            board.mailbox[position] = piece;
             position++;
         }
     }
@@ -144,71 +126,138 @@ ChessBoard createBoardFromFen(const std::string& fen) {
     initOccupancies(board);
 
     board.hash = zobristHash(board);
+    board.pawn_hash = pawnHash(board);
+
+    refreshEvaluation(board);
 
     return board;
 }
 
 
-U64 perftNodes = 0ULL;
-void perftHelper(ChessBoard &board, int depth) {
+// Perft hash, one slot per index. As with the transposition table the key is
+// stored xor'd with the data so threads can share it without locks.
+// data = node count << 8 | depth
+struct PerftSlot {
+    std::atomic<U64> key;
+    std::atomic<U64> data;
+};
+
+constexpr size_t PERFT_HASH_SIZE = 1 << 21; // 32 MB
+PerftSlot perftHash[PERFT_HASH_SIZE];
+
+bool probePerftHash(U64 hash, int depth, U64 &nodes) {
+    PerftSlot &slot = perftHash[hash & (PERFT_HASH_SIZE - 1)];
+    U64 data = slot.data.load(std::memory_order_relaxed);
+    U64 key = slot.key.load(std::memory_order_relaxed) ^ data;
+
+    if (key == hash && (data & 0xFF) == static_cast<U64>(depth)) {
+        nodes = data >> 8;
+        return true;
+    }
+    return false;
+}
+
+void storePerftHash(U64 hash, int depth, U64 nodes) {
+    PerftSlot &slot = perftHash[hash & (PERFT_HASH_SIZE - 1)];
+    U64 data = (nodes << 8) | depth;
+    slot.key.store(hash ^ data, std::memory_order_relaxed);
+    slot.data.store(data, std::memory_order_relaxed);
+}
+
+U64 perftHelper(ChessBoard &board, int depth) {
     if (depth == 0) {
-        perftNodes ++;
-        return;
+        return 1;
+    }
+
+    // bulk count the last ply instead of making every move
+    if (depth == 1) {
+        return countLegalMoves(board);
+    }
+
+    U64 nodes = 0;
+    if (probePerftHash(board.hash, depth, nodes)) {
+        return nodes;
     }
 
     Moves moves;
     generateMoves(board, moves);
 
-    ChessBoard boardCopy = board;
+    UndoInfo undo;
     for (int i=0; i<moves.count; i++) {
-        int move = moves.list[i];
+        makeMove(board, moves.list[i], undo);
 
-        if (makeMove(board, move) == false) {
-            board = boardCopy;
-            continue;
-        }
-
-        perftHelper(board, depth - 1);
+        nodes += perftHelper(board, depth - 1);
 
-        board = boardCopy;
+        unmakeMove(board, moves.list[i], undo);
     }
+
+    storePerftHash(board.hash, depth, nodes);
+
+    return nodes;
 }
 
-void perft(ChessBoard &board, int depth) {
+U64 perft(ChessBoard &board, int depth, int numThreads, bool divide) {
+
+    logDebug("Starting PERFT with depth", depth, "on", numThreads, "threads");
+
+    auto start = std::chrono::steady_clock::now();
 
-    writeToLogFile("Starting PERFT with depth", depth);
-    perftNodes = 0;
     Moves moves;
     generateMoves(board, moves);
 
-    ChessBoard boardCopy = board;
+    // each root move becomes a job for the pool
+    std::vector<uint32_t> rootMoves(moves.list, moves.list + moves.count);
 
-    for (int i=0; i<moves.count; i++) {
-        int move = moves.list[i];
+    std::vector<U64> rootNodes(rootMoves.size(), 0);
+    std::atomic<size_t> nextMove(0);
 
-        if (makeMove(board, move) == false) {
-            board = boardCopy;
-            continue;
+    // threads pull the next root move when they finish one, so a single large subtree
+    // does not leave the others idle
+    auto worker = [&]() {
+        size_t index;
+        while ((index = nextMove++) < rootMoves.size()) {
+            ChessBoard child = board;
+            makeMove(child, rootMoves[index]);
+            rootNodes[index] = depth > 0 ? perftHelper(child, depth - 1) : 0;
         }
+    };
 
-        U64 cummulative_nodes = perftNodes;
+    if (numThreads < 1) numThreads = 1;
+    std::vector<std::thread> pool;
+    for (int i=1; i<numThreads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
 
-        perftHelper(board, depth - 1);
+    U64 totalNodes = 0;
+    for (size_t i=0; i<rootMoves.size(); i++) {
+        uint32_t move = rootMoves[i];
 
-        U64 old_nodes = perftNodes - cummulative_nodes;
+        totalNodes += rootNodes[i];
 
-        board = boardCopy;
+        if (!divide) continue;
 
         printf("%s%s%c ", 
             squaretoCoordinate(decodeMoveFrom(move)).c_str(),
             squaretoCoordinate(decodeMoveTo(move)).c_str(),
             decodePromotionPiece(move)!=no_piece ? ascii_pieces[(decodePromotionPiece(move) % 6) + 6] : ' ');
 
-        std::cout << old_nodes << std::endl;
+        std::cout << rootNodes[i] << std::endl;
     }
 
-    std::cout << std::endl <<  perftNodes << std::endl;
+    if (divide) {
+        std::cout << std::endl <<  totalNodes << std::endl;
 
-    writeToLogFile("PERFT finished");
-}
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+        // timing goes to stderr so scripts reading the divide output are not affected
+        std::cerr << "time " << elapsed << " ms nps " << (totalNodes * 1000) / (elapsed + 1) << std::endl;
+    }
 
+    logDebug("PERFT finished");
+
+    return totalNodes;
+}
@@ -11,10 +11,44 @@
 
 typedef unsigned long long U64;
 
-extern U64 piece_keys[12][64];
-extern U64 side_key;
-extern U64 enpassant_keys[65];
-extern U64 castling_keys[16];
+// fixed seed so hashing, and with it bench node counts, are the same on every run
+constexpr U64 ZOBRIST_SEED = 0x9E3779B97F4A7C15ULL;
+
+// splitmix64, simple enough to run at compile time
+constexpr U64 splitMix64(U64 &state) {
+    U64 z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+struct ZobristKeys {
+    U64 pieces[12][64] = {};
+    U64 castling[16] = {};
+    U64 enpassant[65] = {};
+    U64 side = 0;
+};
+
+constexpr ZobristKeys generateZobristKeys(U64 seed) {
+    ZobristKeys keys;
+    U64 state = seed;
+
+    for (auto &squares : keys.pieces) {
+        for (U64 &key : squares) key = splitMix64(state);
+    }
+    for (U64 &key : keys.castling) key = splitMix64(state);
+    for (U64 &key : keys.enpassant) key = splitMix64(state);
+    keys.side = splitMix64(state);
+
+    return keys;
+}
+
+// the keys are part of the binary, nothing has to be set up before hashing a position
+inline constexpr ZobristKeys zobristKeys = generateZobristKeys(ZOBRIST_SEED);
+inline constexpr const U64 (&piece_keys)[12][64] = zobristKeys.pieces;
+inline constexpr const U64 (&castling_keys)[16] = zobristKeys.castling;
+inline constexpr const U64 (&enpassant_keys)[65] = zobristKeys.enpassant;
+inline constexpr U64 side_key = zobristKeys.side;
 
 using namespace std;
 
@@ -46,20 +80,36 @@ enum {P, N, B, R, Q, K, p, n, b, r, q, k, no_piece};
 
 enum {white, black, both};
 
+struct Accumulator;
+
 struct ChessBoard {
     U64 bitboards[12];
     U64 occupancies[3];
+    uint8_t mailbox[64]; // piece on every square, no_piece when empty
     U64 hash; // hash of the board position
+    U64 pawn_hash; // hash of the pawns alone, keys the pawn structure cache
+    int mg_score; // material + piece squares for white minus black, kept up to date by makeMove
+    int eg_score;
+    int phase;
     bool white_to_move;
     uint8_t castling_rights; // 1 = white kingside, 2 = white queenside, 4 = black kingside, 8 = black queenside
     int en_passant_square;
     unsigned half_move_counter;
     unsigned full_move_counter;
+    Accumulator *accumulator = nullptr; // top of the search thread's nnue accumulator stack, null when not in use
 };
 
+// Builds the tables that are too large to generate at compile time (magic attacks,
+// evaluation). Has to run once before the first position is set up.
+void initEngine();
+
+// only parses, all tables must already be built
 ChessBoard createBoardFromFen(const std::string& fen);
 
 U64 zobristHash(const ChessBoard &board);
 
+// counts the leaf nodes below board, with divide the count for every root move is printed
+U64 perft(ChessBoard &board, int depth, int numThreads, bool divide = true);
+
 
 #endif
\ No newline at end of file
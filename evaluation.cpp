@@ -1,5 +1,7 @@
 #include "evaluation.h"
 
+// The tables are written from white's point of view with rank 1 on the first row,
+// our squares start at a8 so white pieces look up flip(square).
 int piece_square_table[6][64] = {
     // Pawn
     { 0,  0,  0,  0,  0,  0,  0,  0,
@@ -51,15 +53,27 @@ int piece_square_table[6][64] = {
      -10,  0,  0,  0,  0,  0,  0,-10,
      -20,-10,-10, -5, -5,-10,-10,-20},
       
-    // King (this table should be used in the endgame)
-    {-50,-40,-30,-20,-20,-30,-40,-50,
-     -30,-20,-10,  0,  0,-10,-20,-30,
-     -30,-10, 20, 30, 30, 20,-10,-30,
-     -30,-10, 30, 40, 40, 30,-10,-30,
-     -30,-10, 30, 40, 40, 30,-10,-30,
-     -30,-10, 20, 30, 30, 20,-10,-30,
-     -30,-30,  0,  0,  0,  0,-30,-30,
-     -50,-30,-30,-30,-30,-30,-30,-50}
+    // King in the middlegame, stay behind the pawns
+    { 20, 30, 10,  0,  0, 10, 30, 20,
+      20, 20,  0,  0,  0,  0, 20, 20,
+     -10,-20,-20,-20,-20,-20,-20,-10,
+     -20,-30,-30,-40,-40,-30,-30,-20,
+     -30,-40,-40,-50,-50,-40,-40,-30,
+     -30,-40,-40,-50,-50,-40,-40,-30,
+     -30,-40,-40,-50,-50,-40,-40,-30,
+     -30,-40,-40,-50,-50,-40,-40,-30}
+};
+
+// King (this table should be used in the endgame)
+int king_endgame_table[64] = {
+    -50,-30,-30,-30,-30,-30,-30,-50,
+    -30,-30,  0,  0,  0,  0,-30,-30,
+    -30,-10, 20, 30, 30, 20,-10,-30,
+    -30,-10, 30, 40, 40, 30,-10,-30,
+    -30,-10, 30, 40, 40, 30,-10,-30,
+    -30,-10, 20, 30, 30, 20,-10,-30,
+    -30,-20,-10,  0,  0,-10,-20,-30,
+    -50,-40,-30,-20,-20,-30,-40,-50
 };
 
 int piece_values[12] = {
@@ -67,21 +81,117 @@ int piece_values[12] = {
     -100, -300, -300, -500, -900, -10000 // Negative for black pieces as we are assuming the point of view of white
 };
 
-int evaluate(ChessBoard &board) {
-    int score = 0;
+// material + piece square value of every piece on every square for the middlegame and
+// the endgame, signed for white and with the flip for white already applied
+int mg_table[12][64];
+int eg_table[12][64];
+
+// how much each piece counts towards the game phase, 24 is the full starting material
+const int phase_values[12] = {
+    0, 1, 1, 2, 4, 0,
+    0, 1, 1, 2, 4, 0
+};
+
+bool evaluationTablesInitialized = false;
+
+void initEvaluationTables() {
+    if (evaluationTablesInitialized) return;
+    evaluationTablesInitialized = true;
+
+    initPawnTables();
+
+    for (int piece = P; piece <= K; piece++) {
+        for (int square = 0; square < 64; square++) {
+            int mg = piece_square_table[piece][flip(square)];
+            int eg = piece == K ? king_endgame_table[flip(square)] : mg;
+
+            mg_table[piece][square] = piece_values[piece] + mg;
+            eg_table[piece][square] = piece_values[piece] + eg;
+
+            // black uses the same tables mirrored, with the sign swapped
+            mg_table[piece + 6][square] = piece_values[piece + 6] - piece_square_table[piece][square];
+            eg_table[piece + 6][square] = piece_values[piece + 6] - (piece == K ? king_endgame_table[square] : piece_square_table[piece][square]);
+        }
+    }
+}
+
+void refreshEvaluation(ChessBoard &board) {
+    board.mg_score = 0;
+    board.eg_score = 0;
+    board.phase = 0;
 
     for (int i = 0; i < 12; i++) {
         U64 bb = board.bitboards[i];
         while (bb) {
-            int index = __builtin_ctzll(bb);
-            score += piece_values[i];
-            if(i < 6) // For white pieces
-                score -= piece_square_table[i][index];
-            else // For black pieces
-                score += piece_square_table[i-6][flip(index)];
+            addPieceScore(board, i, __builtin_ctzll(bb));
             bb &= bb - 1;
         }
     }
+}
+
+int getPieceValue(int piece) {
+    return piece_values[piece];
+}
+
+int getPieceSquareValue(int piece, int square) {
+    return mg_table[piece][square] - piece_values[piece];
+}
+
+// Blends the incrementally kept middlegame and endgame scores plus the pawn structure
+// by the game phase, the result is from the point of view of the side to move
+static int blendScores(ChessBoard &board, const PawnEntry &pawns) {
+    int phase = std::min(board.phase, PHASE_MAX);
+    int mg = board.mg_score + pawns.mg_score;
+    int eg = board.eg_score + pawns.eg_score;
+    int score = (mg * phase + eg * (PHASE_MAX - phase)) / PHASE_MAX;
+
+    return board.white_to_move ? score : -score;
+}
+
+int evaluate(ChessBoard &board) {
+    if (nnueEnabled()) {
+        return evaluateNNUE(board);
+    }
+
+    PawnEntry pawns;
+    evaluatePawns(board, pawns);
+    return blendScores(board, pawns);
+}
+
+int evaluate(ChessBoard &board, PawnTable &pawns) {
+    if (nnueEnabled()) {
+        return evaluateNNUE(board);
+    }
 
+    return blendScores(board, probePawnTable(pawns, board));
+}
+
+int evaluate(ChessBoard &board, PawnTable &pawns, EvalCache &cache) {
+    int score;
+    if (cache.probe(board.hash, score)) {
+        return score;
+    }
+
+    score = evaluate(board, pawns);
+    cache.store(board.hash, score);
     return score;
-}
\ No newline at end of file
+}
+
+void EvalCache::resize(size_t megabytes) {
+    megabytes = std::min(megabytes, EVAL_CACHE_MAX_MB);
+
+    size_t count = megabytes * 1024 * 1024 / sizeof(U64);
+    while (count & (count - 1)) {
+        count &= count - 1;
+    }
+
+    entries.assign(count, 0);
+    mask = count ? count - 1 : 0;
+    sizeMB = megabytes;
+    hits = misses = 0;
+}
+
+void EvalCache::clear() {
+    std::fill(entries.begin(), entries.end(), 0);
+    hits = misses = 0;
+}
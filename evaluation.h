@@ -4,11 +4,96 @@
 #include "engine.h"
 #include "utils.h"
 #include "logger.h"
+#include "pawns.h"
+#include "nnue.h"
+#include <algorithm>
+#include <vector>
 
 #define flip(sq) ((sq)^56)
 
+constexpr int PHASE_MAX = 24;
+
+extern int mg_table[12][64];
+extern int eg_table[12][64];
+extern const int phase_values[12];
+
+// builds mg_table and eg_table, only does the work once
+void initEvaluationTables();
+
+// recomputes the incremental scores of the board from scratch
+void refreshEvaluation(ChessBoard &board);
+
+inline void addPieceScore(ChessBoard &board, int piece, int square) {
+    board.mg_score += mg_table[piece][square];
+    board.eg_score += eg_table[piece][square];
+    board.phase += phase_values[piece];
+}
+
+inline void removePieceScore(ChessBoard &board, int piece, int square) {
+    board.mg_score -= mg_table[piece][square];
+    board.eg_score -= eg_table[piece][square];
+    board.phase -= phase_values[piece];
+}
+
+inline void movePieceScore(ChessBoard &board, int piece, int from, int to) {
+    board.mg_score += mg_table[piece][to] - mg_table[piece][from];
+    board.eg_score += eg_table[piece][to] - eg_table[piece][from];
+}
+
 int getPieceSquareValue(int piece, int square);
 int getPieceValue(int piece);
+
+// network score when nnue is enabled, the hand written evaluation otherwise
 int evaluate(ChessBoard &board);
 
+// same score with the pawn structure taken from the thread's pawn table
+int evaluate(ChessBoard &board, PawnTable &pawns);
+
+constexpr size_t EVAL_CACHE_DEFAULT_MB = 1;
+constexpr size_t EVAL_CACHE_MAX_MB = 256;
+
+// Lossy cache of final evaluations keyed by the position hash, one per search thread so it
+// needs no synchronisation. An entry is a single word: the upper 48 bits of the key and
+// the score in the lower 16, a colliding position simply overwrites it.
+class EvalCache {
+    public:
+        // reallocate to a power of two number of entries, 0 turns the cache off
+        void resize(size_t megabytes);
+
+        void clear();
+
+        size_t megabytes() const {
+            return sizeMB;
+        }
+
+        bool probe(U64 key, int &score) {
+            if (entries.empty()) return false;
+            U64 entry = entries[key & mask];
+            if ((entry ^ key) >> 16 == 0 && entry != 0) {
+                score = static_cast<int16_t>(entry & 0xFFFF);
+                hits++;
+                return true;
+            }
+            misses++;
+            return false;
+        }
+
+        void store(U64 key, int score) {
+            // does not fit the entry, only possible in illegal positions without a king
+            if (entries.empty() || score != static_cast<int16_t>(score)) return;
+            entries[key & mask] = (key & ~0xFFFFULL) | static_cast<uint16_t>(score);
+        }
+
+        size_t hits = 0;
+        size_t misses = 0;
+
+    private:
+        std::vector<U64> entries;
+        size_t mask = 0;
+        size_t sizeMB = 0;
+};
+
+// checks the thread's eval cache before evaluating
+int evaluate(ChessBoard &board, PawnTable &pawns, EvalCache &cache);
+
 #endif
\ No newline at end of file
@@ -1,24 +1,199 @@
 #include "logger.h"
+#include <algorithm>
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
 
+std::atomic<int> logLevel{LOG_INFO};
 
-// Function to get the current time as a string
-std::string getCurrentTime() {
-    std::time_t now = std::time(0);
-    std::tm* timeStruct = std::localtime(&now);
-    char buffer[80];
-    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeStruct);
-    return std::string(buffer);
+// One slot of the ring, a bounded multi producer queue: a producer claims a position by
+// advancing head, and the sequence tells whether the slot is free (== position), filled
+// (== position + 1) or still holds a record from the previous lap.
+struct LogRecord {
+    std::atomic<size_t> sequence;
+    int level;
+    int64_t time; // milliseconds since the epoch
+    size_t length;
+    char text[LOG_RECORD_SIZE];
+};
+
+static LogRecord ring[LOG_RING_SIZE];
+static std::atomic<size_t> ringHead{0};
+static size_t ringTail = 0; // read position, only used with writerMutex held
+static std::atomic<size_t> droppedRecords{0};
+
+static struct RingInit {
+    RingInit() {
+        for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+            ring[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+} ringInit;
+
+// everything below is only touched by the writer thread and the uci thread that
+// configures it, never by a thread that logs
+static std::mutex writerMutex;
+static std::condition_variable writerWake;
+static std::thread writer;
+static bool writerStop = false;
+static std::string logPath = LOG_DEFAULT_FILE;
+static size_t logMaxBytes = LOG_DEFAULT_MAX_KB * 1024;
+static std::ofstream logFile;
+
+static const char *levelNames[] = {"debug", "info", "warning", "error", "off"};
+
+void pushLogRecord(int level, const char *text, size_t length) {
+    size_t position = ringHead.load(std::memory_order_relaxed);
+    LogRecord *record;
+
+    for (;;) {
+        record = &ring[position & (LOG_RING_SIZE - 1)];
+        size_t sequence = record->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+        if (difference == 0) {
+            if (ringHead.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        } else if (difference < 0) {
+            // the writer has not freed this slot yet, the ring is full
+            droppedRecords.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = ringHead.load(std::memory_order_relaxed);
+        }
+    }
+
+    record->level = level;
+    record->time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    record->length = std::min(length, LOG_RECORD_SIZE);
+    std::memcpy(record->text, text, record->length);
+    record->sequence.store(position + 1, std::memory_order_release);
+}
+
+static void formatTime(int64_t time, char *buffer, size_t size) {
+    std::time_t seconds = time / 1000;
+    std::tm parts;
+    localtime_r(&seconds, &parts);
+    size_t length = std::strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &parts);
+    std::snprintf(buffer + length, size - length, ".%03d", static_cast<int>(time % 1000));
+}
+
+// moves a full log to <file>.1, called with the writer mutex held
+static void rotateLogFile() {
+    logFile.close();
+    std::string backup = logPath + ".1";
+    std::rename(logPath.c_str(), backup.c_str());
+    logFile.open(logPath, std::ios_base::trunc);
 }
 
+// writes every filled slot, called with the writer mutex held
+static void drainRing() {
+    bool wrote = false;
 
-void clearLogs() {
-    std::string logFile = "blunder-matic.log";
-    std::ofstream logFileStream(logFile);
+    for (;;) {
+        LogRecord &record = ring[ringTail & (LOG_RING_SIZE - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != ringTail + 1) break;
+
+        if (logFile.is_open()) {
+            char time[32];
+            formatTime(record.time, time, sizeof(time));
+            logFile << "[" << time << "] " << levelNames[record.level] << ": ";
+            logFile.write(record.text, record.length);
+            logFile << '\n';
+            wrote = true;
+        }
+
+        record.sequence.store(ringTail + LOG_RING_SIZE, std::memory_order_release);
+        ringTail++;
+    }
+
+    size_t dropped = droppedRecords.exchange(0, std::memory_order_relaxed);
+    if (dropped && logFile.is_open()) {
+        logFile << "[log] " << dropped << " records dropped, the ring was full\n";
+        wrote = true;
+    }
+
+    if (wrote) {
+        logFile.flush();
+        if (logMaxBytes && static_cast<size_t>(logFile.tellp()) > logMaxBytes) {
+            rotateLogFile();
+        }
+    }
+}
 
-    if (logFileStream.is_open()) {
-        // Close the log file, which will save the empty file
-        logFileStream.close();
-    } else {
-        std::cerr << "Unable to open log file: " << logFile << std::endl;
+static void writerLoop() {
+    std::unique_lock<std::mutex> lock(writerMutex);
+    while (!writerStop) {
+        // producers never wait on the writer, it simply polls the ring
+        writerWake.wait_for(lock, std::chrono::milliseconds(10));
+        drainRing();
     }
-}
\ No newline at end of file
+    drainRing();
+}
+
+static struct WriterShutdown {
+    ~WriterShutdown() {
+        stopLogger();
+    }
+} writerShutdown;
+
+void startLogger() {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    if (writer.joinable()) return;
+
+    if (!logPath.empty()) {
+        logFile.open(logPath, std::ios_base::trunc);
+        if (!logFile.is_open()) {
+            std::cerr << "Unable to open log file: " << logPath << std::endl;
+        }
+    }
+    writerStop = false;
+    writer = std::thread(writerLoop);
+}
+
+void stopLogger() {
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        if (!writer.joinable()) return;
+        writerStop = true;
+    }
+    writerWake.notify_one();
+    writer.join();
+
+    std::lock_guard<std::mutex> lock(writerMutex);
+    logFile.close();
+}
+
+void setLogFile(const std::string &path) {
+    std::lock_guard<std::mutex> lock(writerMutex);
+
+    // records queued so far belong in the old file
+    drainRing();
+    logFile.close();
+
+    logPath = path == "<empty>" ? "" : path;
+    if (!logPath.empty()) {
+        logFile.open(logPath, std::ios_base::app);
+        if (!logFile.is_open()) {
+            std::cerr << "Unable to open log file: " << logPath << std::endl;
+        }
+    }
+}
+
+void setLogMaxSize(size_t kilobytes) {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    logMaxBytes = kilobytes * 1024;
+}
+
+bool setLogLevel(const std::string &name) {
+    for (int level = LOG_DEBUG; level <= LOG_OFF; level++) {
+        if (name == levelNames[level]) {
+            logLevel.store(level, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
@@ -1,56 +1,111 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <string>
-#include <ctime>
-#include <iostream>
-#include <sstream>
+#include <type_traits>
 
-std::string getCurrentTime();
+enum LogLevel {LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR, LOG_OFF};
 
-// Define the base case function directly in the header file
-inline void writeToLogFileHelper(std::ostringstream& logStream) {
-    // Do nothing, end of recursion
-}
+// calls below this level are compiled out, build with -DLOG_COMPILE_LEVEL=1 to drop the debug logs
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
 
-template<typename... Args>
-void writeToLogFile(Args... args);
+#define LOG_DEFAULT_FILE "blunder-matic.log"
 
-// Function implementations
+// records waiting for the writer thread, a power of two, and the longest message kept
+constexpr size_t LOG_RING_SIZE = 1024;
+constexpr size_t LOG_RECORD_SIZE = 240;
 
-// Recursive variadic template function to process the arguments
-template<typename T, typename... Args>
-void writeToLogFileHelper(std::ostringstream& logStream, T value, Args... args) {
-    logStream << value << " ";
-    writeToLogFileHelper(logStream, args...);
-}
+// the log is rotated to <file>.1 once it grows past this, 0 never rotates
+constexpr size_t LOG_DEFAULT_MAX_KB = 1024;
 
-// Function to write a message to the log file
-template<typename... Args>
-void writeToLogFile(Args... args) {
-    std::ofstream logFileStream;
-    std::ostringstream logMessageStream;
-    std::string logFile = "blunder-matic.log";
+// records below this level are dropped when the call is made
+extern std::atomic<int> logLevel;
+
+// Truncates the log file and starts the thread that writes the records out. Records
+// logged before this are kept and written once it runs.
+void startLogger();
 
-    // Process the arguments and create the message string
-    writeToLogFileHelper(logMessageStream, args...);
-    std::string message = logMessageStream.str();
+// writes out everything still queued and stops the writer, also done at exit
+void stopLogger();
 
-    // Open the log file in append mode
-    logFileStream.open(logFile, std::ios_base::app);
+// an empty path (or "<empty>") turns the file off, the records are still drained
+void setLogFile(const std::string &path);
 
-    if (logFileStream.is_open()) {
-        // Write the timestamp and message to the log file
-        logFileStream << "[" << getCurrentTime() << "] " << message << std::endl;
+void setLogMaxSize(size_t kilobytes);
 
-        // Close the log file
-        logFileStream.close();
+// debug, info, warning, error or off, returns false for anything else
+bool setLogLevel(const std::string &name);
+
+// Copies a formatted record into the ring buffer. Never blocks: when the writer has
+// fallen behind and the ring is full the record is counted as dropped instead.
+void pushLogRecord(int level, const char *text, size_t length);
+
+// appends one argument to the record, the formatting never allocates
+template<typename T>
+void appendLogValue(char *&out, char *end, const T &value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        appendLogValue(out, end, value ? "true" : "false");
+    } else if constexpr (std::is_same_v<T, char>) {
+        if (out < end) *out++ = value;
+    } else if constexpr (std::is_integral_v<T>) {
+        out = std::to_chars(out, end, value).ptr;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        int written = std::snprintf(out, end - out, "%.3f", static_cast<double>(value));
+        out += std::max(0, std::min<int>(written, static_cast<int>(end - out)));
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        size_t length = std::min<size_t>(value.size(), end - out);
+        std::memcpy(out, value.data(), length);
+        out += length;
     } else {
-        std::cerr << "Unable to open log file: " << logFile << std::endl;
+        // string literals and char pointers
+        const char *text = value;
+        while (*text && out < end) *out++ = *text++;
+    }
+}
+
+// formats the arguments separated by spaces and queues the record
+template<int level, typename... Args>
+void logMessage(const Args &...args) {
+    if constexpr (level >= LOG_COMPILE_LEVEL) {
+        if (level < logLevel.load(std::memory_order_relaxed)) return;
+
+        char buffer[LOG_RECORD_SIZE];
+        char *out = buffer;
+        char *end = buffer + LOG_RECORD_SIZE;
+        bool first = true;
+        ((first || out == end ? void() : void(*out++ = ' '), first = false, appendLogValue(out, end, args)), ...);
+
+        pushLogRecord(level, buffer, out - buffer);
     }
 }
 
+template<typename... Args>
+void logDebug(const Args &...args) {
+    logMessage<LOG_DEBUG>(args...);
+}
+
+template<typename... Args>
+void logInfo(const Args &...args) {
+    logMessage<LOG_INFO>(args...);
+}
+
+template<typename... Args>
+void logWarning(const Args &...args) {
+    logMessage<LOG_WARNING>(args...);
+}
+
+template<typename... Args>
+void logError(const Args &...args) {
+    logMessage<LOG_ERROR>(args...);
+}
 
-void clearLogs();
 #endif
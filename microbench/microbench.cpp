@@ -0,0 +1,304 @@
+// Micro benchmarks of the engine's hot paths over the bench positions.
+//
+// A program of its own next to the engine, built and run by run-microbench.sh from the
+// repository root: every engine source except uci.cpp is linked in, so the code measured
+// is the code the engine runs.
+//
+//     microbench [--reps N] [--warmup ms] [--json file] [filter]
+//
+// Every case first runs for the warm-up time, which also sizes a repetition to about
+// REP_TARGET_MS, then is timed over the repetitions. The median repetition is reported
+// as ns/op, cycles/op and million ops per second, the fastest as min ns/op. Cycles are
+// read from the time stamp counter, so they tick at its fixed rate and not the core clock.
+// With --json the results are also written to a file meant to be diffed between commits.
+// The checksum of a case is taken over one pass and only changes with the results.
+
+#include "../engine.h"
+#include "../moves.h"
+#include "../evaluation.h"
+#include "../bench.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_TSC 1
+#else
+#define HAS_TSC 0
+#endif
+
+constexpr int DEFAULT_REPETITIONS = 10;
+constexpr int DEFAULT_WARMUP_MS = 200;
+constexpr int REP_TARGET_MS = 50;
+
+// keeps the compiler from dropping the results of the timed passes
+static volatile U64 sink;
+
+static uint64_t readCycles() {
+#if HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// one pass over the corpus, returns the number of operations and folds the results into checksum
+struct MicroCase {
+    std::string name;
+    std::function<size_t(U64 &checksum)> pass;
+};
+
+struct MicroResult {
+    std::string name;
+    size_t opsPerRep;
+    double nsPerOp;
+    double minNsPerOp;
+    double cyclesPerOp;
+    double mopsPerSecond;
+    U64 checksum;
+};
+
+struct Corpus {
+    std::vector<ChessBoard> boards;
+    std::vector<Moves> moves; // the legal moves of every board
+};
+
+static std::vector<MicroCase> buildCases(Corpus &corpus) {
+    std::vector<MicroCase> cases;
+
+    cases.push_back({"generateMoves", [&corpus](U64 &checksum) {
+        size_t ops = 0;
+        for (ChessBoard &board : corpus.boards) {
+            Moves moves;
+            generateMoves(board, moves);
+            checksum += moves.count;
+            ops++;
+        }
+        return ops;
+    }});
+
+    cases.push_back({"makeMove+unmakeMove", [&corpus](U64 &checksum) {
+        size_t ops = 0;
+        for (size_t i = 0; i < corpus.boards.size(); i++) {
+            ChessBoard &board = corpus.boards[i];
+            const Moves &moves = corpus.moves[i];
+            for (int j = 0; j < moves.count; j++) {
+                UndoInfo undo;
+                makeMove(board, moves.list[j], undo);
+                checksum ^= board.hash;
+                unmakeMove(board, moves.list[j], undo);
+            }
+            ops += moves.count;
+        }
+        return ops;
+    }});
+
+    cases.push_back({"isSquareAttacked", [&corpus](U64 &checksum) {
+        size_t ops = 0;
+        for (ChessBoard &board : corpus.boards) {
+            for (int square = 0; square < 64; square++) {
+                checksum += isSquareAttacked(board, white, square);
+                checksum += isSquareAttacked(board, black, square);
+            }
+            ops += 128;
+        }
+        return ops;
+    }});
+
+    cases.push_back({"getRookAttacks", [&corpus](U64 &checksum) {
+        size_t ops = 0;
+        for (const ChessBoard &board : corpus.boards) {
+            for (int square = 0; square < 64; square++) {
+                checksum ^= getRookAttacks(square, board.occupancies[both]);
+            }
+            ops += 64;
+        }
+        return ops;
+    }});
+
+    cases.push_back({"getBishopAttacks", [&corpus](U64 &checksum) {
+        size_t ops = 0;
+        for (const ChessBoard &board : corpus.boards) {
+            for (int square = 0; square < 64; square++) {
+                checksum ^= getBishopAttacks(square, board.occupancies[both]);
+            }
+            ops += 64;
+        }
+        return ops;
+    }});
+
+    cases.push_back({"evaluate", [&corpus](U64 &checksum) {
+        size_t ops = 0;
+        for (ChessBoard &board : corpus.boards) {
+            checksum += evaluate(board);
+            ops++;
+        }
+        return ops;
+    }});
+
+    // the way the search calls it, with the pawn structure cached
+    auto pawns = std::make_shared<PawnTable>();
+    cases.push_back({"evaluate+pawnTable", [&corpus, pawns](U64 &checksum) {
+        size_t ops = 0;
+        for (ChessBoard &board : corpus.boards) {
+            checksum += evaluate(board, *pawns);
+            ops++;
+        }
+        return ops;
+    }});
+
+    cases.push_back({"zobristHash", [&corpus](U64 &checksum) {
+        size_t ops = 0;
+        for (const ChessBoard &board : corpus.boards) {
+            checksum ^= zobristHash(board);
+            ops++;
+        }
+        return ops;
+    }});
+
+    return cases;
+}
+
+static int64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static MicroResult runCase(MicroCase &microCase, int repetitions, int warmupMs) {
+    U64 checksum = 0;
+    microCase.pass(checksum);
+
+    // warm up caches and branch predictors, and count how many passes fit in the time
+    U64 warmupSum = 0;
+    size_t warmupPasses = 0;
+    auto start = std::chrono::steady_clock::now();
+    do {
+        microCase.pass(warmupSum);
+        warmupPasses++;
+    } while (elapsedNs(start) < warmupMs * 1000000LL);
+    sink = warmupSum;
+
+    double nsPerPass = static_cast<double>(elapsedNs(start)) / warmupPasses;
+    size_t passes = std::max<size_t>(1, static_cast<size_t>(REP_TARGET_MS * 1e6 / nsPerPass));
+
+    std::vector<double> nsPerOp, cyclesPerOp;
+    size_t opsPerRep = 0;
+    for (int rep = 0; rep < repetitions; rep++) {
+        U64 sum = 0;
+        size_t ops = 0;
+
+        auto repStart = std::chrono::steady_clock::now();
+        uint64_t cyclesStart = readCycles();
+        for (size_t i = 0; i < passes; i++) {
+            ops += microCase.pass(sum);
+        }
+        uint64_t cycles = readCycles() - cyclesStart;
+        int64_t ns = elapsedNs(repStart);
+
+        nsPerOp.push_back(static_cast<double>(ns) / ops);
+        cyclesPerOp.push_back(static_cast<double>(cycles) / ops);
+        opsPerRep = ops;
+        sink = sum;
+    }
+
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    std::sort(cyclesPerOp.begin(), cyclesPerOp.end());
+
+    MicroResult result;
+    result.name = microCase.name;
+    result.opsPerRep = opsPerRep;
+    result.nsPerOp = nsPerOp[nsPerOp.size() / 2];
+    result.minNsPerOp = nsPerOp[0];
+    result.cyclesPerOp = cyclesPerOp[cyclesPerOp.size() / 2];
+    result.mopsPerSecond = 1000.0 / result.nsPerOp;
+    result.checksum = checksum;
+    return result;
+}
+
+static void writeJson(const std::string &path, const std::vector<MicroResult> &results, int repetitions) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open " << path << std::endl;
+        return;
+    }
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\n";
+    file << "  \"positions\": " << benchPositionCount << ",\n";
+    file << "  \"repetitions\": " << repetitions << ",\n";
+    file << "  \"slider_indexing\": \"" << (sliderIndexingUsesPext() ? "pext" : "magics") << "\",\n";
+    file << "  \"cases\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const MicroResult &result = results[i];
+        file << "    {\"name\": \"" << result.name << "\""
+             << ", \"ops_per_rep\": " << result.opsPerRep
+             << ", \"ns_per_op\": " << result.nsPerOp
+             << ", \"min_ns_per_op\": " << result.minNsPerOp
+             << ", \"cycles_per_op\": " << result.cyclesPerOp
+             << ", \"mops_per_s\": " << result.mopsPerSecond
+             << ", \"checksum\": \"" << std::hex << result.checksum << std::dec << "\"}"
+             << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+
+int main(int argc, char *argv[]) {
+    int repetitions = DEFAULT_REPETITIONS;
+    int warmupMs = DEFAULT_WARMUP_MS;
+    std::string jsonFile, filter;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--reps" && i + 1 < argc) {
+            repetitions = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmupMs = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "usage: " << argv[0] << " [--reps N] [--warmup ms] [--json file] [filter]" << std::endl;
+            return 1;
+        } else {
+            filter = arg;
+        }
+    }
+
+    initEngine();
+
+    Corpus corpus;
+    for (int i = 0; i < benchPositionCount; i++) {
+        corpus.boards.push_back(createBoardFromFen(benchPositions[i]));
+        corpus.moves.emplace_back();
+        generateMoves(corpus.boards.back(), corpus.moves.back());
+    }
+
+    std::vector<MicroCase> cases = buildCases(corpus);
+    std::vector<MicroResult> results;
+
+    std::cout << std::left << std::setw(22) << "case" << std::right
+              << std::setw(12) << "ns/op" << std::setw(12) << "min ns/op"
+              << std::setw(12) << "cycles/op" << std::setw(12) << "Mops/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    for (MicroCase &microCase : cases) {
+        if (!filter.empty() && microCase.name.find(filter) == std::string::npos) continue;
+
+        MicroResult result = runCase(microCase, repetitions, warmupMs);
+        results.push_back(result);
+
+        std::cout << std::left << std::setw(22) << result.name << std::right
+                  << std::setw(12) << result.nsPerOp << std::setw(12) << result.minNsPerOp
+                  << std::setw(12) << result.cyclesPerOp << std::setw(12) << result.mopsPerSecond << std::endl;
+    }
+
+    if (!jsonFile.empty()) {
+        writeJson(jsonFile, results, repetitions);
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "movepicker.h"
+
+// victim and attacker order for MVV-LVA, indexed by piece type
+static const int mvv_lva_values[6] = {1, 3, 3, 5, 9, 20};
+
+MovePicker::MovePicker(ChessBoard &board, ScoredMoves &storage, uint32_t ttMove, const uint32_t *killers, const int (*history)[64], bool inCheck, bool capturesOnly)
+    : board(board), ttMove(ttMove), history(history), inCheck(inCheck), capturesOnly(capturesOnly),
+      index(0), moves(storage.moves), scores(storage.scores) {
+    this->killers[0] = killers ? killers[0] : 0;
+    this->killers[1] = killers ? killers[1] : 0;
+
+    if (inCheck) {
+        stage = ttMove ? STAGE_TT : STAGE_EVASIONS_INIT;
+    } else {
+        stage = ttMove ? STAGE_TT : STAGE_CAPTURES_INIT;
+    }
+    moves.count = 0;
+}
+
+// moves that were already handed out by an earlier stage
+bool MovePicker::isSpecial(uint32_t move) {
+    return move == ttMove || move == killers[0] || move == killers[1];
+}
+
+// most valuable victim first, the cheapest attacker breaks ties, promotions count as
+// winning the promoted piece. En passant has no captured piece in the encoding.
+void MovePicker::scoreCaptures() {
+    for (int i = 0; i < moves.count; i++) {
+        uint32_t move = moves.list[i];
+        int captured = decodeCapturePiece(move);
+        int promotion = decodePromotionPiece(move);
+
+        int victim = captured != no_piece ? mvv_lva_values[captured % 6] : (decodeEnPassantFlag(move) ? 1 : 0);
+        if (promotion != no_piece) victim += mvv_lva_values[promotion % 6];
+
+        scores[i] = victim * 32 - mvv_lva_values[decodePieceType(move) % 6];
+    }
+}
+
+void MovePicker::scoreQuiets() {
+    for (int i = 0; i < moves.count; i++) {
+        uint32_t move = moves.list[i];
+        scores[i] = history ? history[decodeMoveFrom(move)][decodeMoveTo(move)] : 0;
+    }
+}
+
+// selection step: swap the best remaining move to the front of the unvisited part
+uint32_t MovePicker::pickBest() {
+    if (index >= moves.count) return 0;
+
+    int best = index;
+    for (int i = index + 1; i < moves.count; i++) {
+        if (scores[i] > scores[best]) best = i;
+    }
+    std::swap(moves.list[index], moves.list[best]);
+    std::swap(scores[index], scores[best]);
+
+    return moves.list[index++];
+}
+
+uint32_t MovePicker::nextMove() {
+    uint32_t move;
+
+    switch (stage) {
+        case STAGE_TT:
+            stage = inCheck ? STAGE_EVASIONS_INIT : STAGE_CAPTURES_INIT;
+            if ((!capturesOnly || inCheck || decodeCapturePiece(ttMove) != no_piece || decodePromotionPiece(ttMove) != no_piece)
+                && isLegalMove(board, ttMove)) {
+                return ttMove;
+            }
+            ttMove = 0;
+            return nextMove();
+
+        case STAGE_CAPTURES_INIT:
+            generateCaptures(board, moves);
+            scoreCaptures();
+            index = 0;
+            stage = STAGE_CAPTURES;
+            [[fallthrough]];
+
+        case STAGE_CAPTURES:
+            while ((move = pickBest())) {
+                if (move != ttMove) return move;
+            }
+            if (capturesOnly) {
+                stage = STAGE_DONE;
+                return 0;
+            }
+            stage = STAGE_KILLERS;
+            index = 0;
+            [[fallthrough]];
+
+        case STAGE_KILLERS:
+            // killers are quiet moves from a sibling node, they still have to be legal here
+            while (index < 2) {
+                move = killers[index++];
+                if (move && move != ttMove && decodePromotionPiece(move) == no_piece && isLegalMove(board, move)) return move;
+            }
+            stage = STAGE_QUIETS_INIT;
+            [[fallthrough]];
+
+        case STAGE_QUIETS_INIT:
+            generateQuiets(board, moves);
+            scoreQuiets();
+            index = 0;
+            stage = STAGE_QUIETS;
+            [[fallthrough]];
+
+        case STAGE_QUIETS:
+            while ((move = pickBest())) {
+                if (!isSpecial(move)) return move;
+            }
+            stage = STAGE_DONE;
+            return 0;
+
+        case STAGE_EVASIONS_INIT:
+            generateEvasions(board, moves);
+            scoreCaptures();
+            index = 0;
+            stage = STAGE_EVASIONS;
+            [[fallthrough]];
+
+        case STAGE_EVASIONS:
+            while ((move = pickBest())) {
+                if (move != ttMove) return move;
+            }
+            stage = STAGE_DONE;
+            return 0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef MOVEPICKER_H
+#define MOVEPICKER_H
+
+#include <algorithm>
+
+#include "engine.h"
+#include "moves.h"
+
+// stages the picker walks through, each one only runs when the previous ones did not cut off
+enum {
+    STAGE_TT,
+    STAGE_CAPTURES_INIT, STAGE_CAPTURES,
+    STAGE_KILLERS,
+    STAGE_QUIETS_INIT, STAGE_QUIETS,
+    STAGE_EVASIONS_INIT, STAGE_EVASIONS,
+    STAGE_DONE
+};
+
+// backing storage for a picker, owned by the caller so the search can preallocate one per ply
+struct ScoredMoves {
+    Moves moves;
+    int scores[256];
+};
+
+// Hands out the moves of a node one at a time: the transposition table move without
+// generating anything, then captures and promotions, then the killers, then the quiet moves.
+// In check every evasion is generated at once. Quiescence only gets the captures.
+// Each generated list is scored once (MVV-LVA for captures, history for quiets) and the
+// best remaining move is selected lazily, so a cutoff never pays for sorting the rest.
+class MovePicker {
+    public:
+        MovePicker(ChessBoard &board, ScoredMoves &storage, uint32_t ttMove, const uint32_t *killers, const int (*history)[64], bool inCheck, bool capturesOnly = false);
+
+        // next legal move, 0 once every stage is exhausted
+        uint32_t nextMove();
+
+    private:
+        ChessBoard &board;
+        uint32_t ttMove;
+        uint32_t killers[2];
+        const int (*history)[64];
+        bool inCheck;
+        bool capturesOnly;
+
+        int stage;
+        int index;
+        Moves &moves;
+        int *scores;
+
+        bool isSpecial(uint32_t move);
+        void scoreCaptures();
+        void scoreQuiets();
+        uint32_t pickBest();
+};
+
+#endif
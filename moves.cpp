@@ -1,24 +1,39 @@
 #include "moves.h"
 #include "printers.h"
 #include "logger.h"
+#include <algorithm>
+#include <cctype>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
 
 
 bool attackTablesInitialized = false;
 
-U64 knightMasks[64];
-U64 kingMasks[64];
-U64 bishopAttackMasks[64];
-U64 rookAttackMasks[64];
+// Fancy magics: every square owns a slice of one shared attack table, sized to the number
+// of occupancy subsets of its mask instead of a fixed 4096 (rook) or 512 (bishop) slots.
+// With pext the index is the occupancy bits under the mask packed together, which
+// needs the same number of slots, so both layouts share the offsets.
+struct Magic {
+    U64 mask;     // relevant occupancy, edges excluded
+    U64 magic;
+    U64 *attacks; // start of this square's slice
+    int shift;
+};
+
+constexpr int ROOK_TABLE_SIZE = 102400;
+constexpr int BISHOP_TABLE_SIZE = 5248;
 
-// Declare the attack tables as global arrays
-U64 rookAttackTable[64][4096];
-U64 bishopAttackTable[64][512];
+U64 sliderAttackTable[ROOK_TABLE_SIZE + BISHOP_TABLE_SIZE];
+Magic rookMagics[64];
+Magic bishopMagics[64];
 
-// pre-calculate all of the pawn moves so we just do simple lookups when generating the moves
-U64 pawnAttackTable[2][64];
-U64 pawnDoubleTable[2][64];
-U64 pawnSingleTable[2][64];
-U64 pawnEnpassantTable[2][64][8];
+// the indexing the tables were built for, pext is only available in -mbmi2 builds
+bool usePext = false;
+
+void initBetweenTable();
 
 const U64 magicR[64] = {
     0x8a80104000800020ULL,
@@ -158,22 +173,18 @@ const U64 magicB[64] = {
 
 
 // Generate attack bitboard for pawn at the given position and side
-U64 generatePawnAttacks(int side, int square) {
-        U64 attacks = 0;
+constexpr U64 generatePawnAttacks(int side, int square) {
+        // shifting the bitboard rather than the bit index keeps a7 and h2 from shifting
+        // by a negative amount, squares pushed off the board simply fall out
+        U64 bit = 1ULL << square;
 
-        if (side == white) { // White
-            if (square >= 8) { // Exclude 7th and 8th ranks
-                attacks |= ((1ULL << (square - 7)) & NOT_A_FILE) | ((1ULL << (square - 9)) & NOT_H_FILE);
-            }
-        } else { // Black
-            if (square < 56) { // Exclude 1st and 2nd ranks
-                attacks |= ((1ULL << (square+9)) & NOT_A_FILE) | ((1ULL << (square+7)) & NOT_H_FILE);
-            }
+        if (side == white) {
+            return ((bit >> 7) & NOT_A_FILE) | ((bit >> 9) & NOT_H_FILE);
         }
-        return attacks;
+        return ((bit << 9) & NOT_A_FILE) | ((bit << 7) & NOT_H_FILE);
 }
 
-U64 generatePawnDoublePushes(int side, int square) {
+constexpr U64 generatePawnDoublePushes(int side, int square) {
     U64 mask = 0ULL;
     if (side == white && (square / 8) == 6) {
         mask |= (1ULL << (square - 16));
@@ -183,7 +194,7 @@ U64 generatePawnDoublePushes(int side, int square) {
     return mask;
 }
 
-U64 generatePawnSinglePushes(int side, int square) {
+constexpr U64 generatePawnSinglePushes(int side, int square) {
     U64 mask = 0ULL;
     // Precompute single push moves
     if (side==white && square > 7) {
@@ -194,7 +205,7 @@ U64 generatePawnSinglePushes(int side, int square) {
     return mask;
 }
 
-U64 generateKnightMasks(int square) {
+constexpr U64 generateKnightMasks(int square) {
     //Generate the knight tables
     U64 board = 0UL;
     U64 attacks = 0UL;
@@ -218,7 +229,7 @@ U64 generateKnightMasks(int square) {
     return attacks;
 }
 
-U64 generateKingMasks(int square) {
+constexpr U64 generateKingMasks(int square) {
     //Generate the kings tables
     U64 white_board = 0UL;
     U64 attacks = 0UL;
@@ -239,6 +250,35 @@ U64 generateKingMasks(int square) {
     return attacks;
 }
 
+template <typename Generator>
+constexpr std::array<U64, 64> squareTable(Generator generate) {
+    std::array<U64, 64> table = {};
+    for (int square = 0; square < 64; square++) {
+        table[square] = generate(square);
+    }
+    return table;
+}
+
+template <typename Generator>
+constexpr std::array<std::array<U64, 64>, 2> sideTable(Generator generate) {
+    std::array<std::array<U64, 64>, 2> table = {};
+    for (int side = 0; side < 2; side++) {
+        for (int square = 0; square < 64; square++) {
+            table[side][square] = generate(side, square);
+        }
+    }
+    return table;
+}
+
+// leaper and pawn tables are small enough to be built by the compiler
+constexpr std::array<U64, 64> knightMasks = squareTable(generateKnightMasks);
+constexpr std::array<U64, 64> kingMasks = squareTable(generateKingMasks);
+
+// pre-calculate all of the pawn moves so we just do simple lookups when generating the moves
+constexpr std::array<std::array<U64, 64>, 2> pawnAttackTable = sideTable(generatePawnAttacks);
+constexpr std::array<std::array<U64, 64>, 2> pawnDoubleTable = sideTable(generatePawnDoublePushes);
+constexpr std::array<std::array<U64, 64>, 2> pawnSingleTable = sideTable(generatePawnSinglePushes);
+
 U64 generateBishopAttacks(int square, U64 occupancy) {
     U64 attacks = 0;
     int rank = square / RANKS;
@@ -368,81 +408,114 @@ U64 setOccupancy(int index, int bits_in_mask, U64 attack_mask) {
     return occupancy;
 }
 
-void initAttackTables() {
-    if (attackTablesInitialized) return;
-
-    writeToLogFile("Initializing AttackTables");
+static inline size_t sliderIndex(const Magic &magic, U64 occupancy) {
+#ifdef __BMI2__
+    if (usePext) return _pext_u64(occupancy, magic.mask);
+#endif
+    return ((occupancy & magic.mask) * magic.magic) >> magic.shift;
+}
 
-    attackTablesInitialized = true;
-    // generate all masks
-    for (int square = 0; square < BOARD_SIZE; square++) {
-        bishopAttackMasks[square] = generateBishopAttackMask(square);
-        rookAttackMasks[square] = generateRookAttackMask(square);
-        kingMasks[square] = generateKingMasks(square);
-        knightMasks[square] = generateKnightMasks(square);
-        for (int side=0; side < 2; side++) {
-            pawnAttackTable[side][square] = generatePawnAttacks(side, square);
-            pawnDoubleTable[side][square] = generatePawnDoublePushes(side, square);
-            pawnSingleTable[side][square] = generatePawnSinglePushes(side, square);
+// fills one piece's slices starting at table, returns the first slot after them
+static U64 *initSliderAttacks(Magic magics[64], const U64 magicNumbers[64], const int relevantBits[64], U64 *table,
+                              U64 (*generateMask)(int), U64 (*generateAttacks)(int, U64)) {
+    for (int square = 0; square < 64; square++) {
+        Magic &magic = magics[square];
+        magic.mask = generateMask(square);
+        magic.magic = magicNumbers[square];
+        magic.shift = 64 - relevantBits[square];
+        magic.attacks = table;
+
+        int bits = __builtin_popcountll(magic.mask);
+        for (int index = 0; index < (1 << bits); index++) {
+            U64 occupancy = setOccupancy(index, bits, magic.mask);
+            magic.attacks[sliderIndex(magic, occupancy)] = generateAttacks(square, occupancy);
         }
+        table += 1 << bits;
     }
+    return table;
+}
 
-    // generate magic bitboards for sliding pieces
-    for (int square=0; square<64; square++)
-    {
-        // get our rook attack mask
-        U64 rookAttack = rookAttackMasks[square];
-        // get our bishop attack mask
-        U64 bishopAttack = bishopAttackMasks[square];
+static void buildSliderTables() {
+    U64 *next = initSliderAttacks(rookMagics, magicR, rookRelevantBits, sliderAttackTable,
+                                  generateRookAttackMask, generateRookAttacks);
+    initSliderAttacks(bishopMagics, magicB, bishopRelevantBits, next,
+                      generateBishopAttackMask, generateBishopAttacks);
+}
 
-        // get the number of bits in the rook mask
-        int rookRelevantBitCount = __builtin_popcountll(rookAttack);
+bool hasFastPext() {
+#ifdef __BMI2__
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_BMI2)) return false;
+
+    // amd before zen 3 (family 0x19) runs pext in microcode, magics are faster there
+    __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+    bool amd = ebx == 0x68747541; // "Auth"enticAMD
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    int family = ((eax >> 8) & 0xF) + ((eax >> 20) & 0xFF);
+    return !amd || family >= 0x19;
+#else
+    return false;
+#endif
+}
 
-        //get the number of bits in the bishop mask
-        int bishopRelevantBitCount = __builtin_popcountll(bishopAttack);
+bool setSliderIndexing(bool pext) {
+#ifndef __BMI2__
+    pext = false;
+#endif
+    if (pext != usePext) {
+        usePext = pext;
+        buildSliderTables();
+    }
+    return usePext;
+}
 
-        // get the number of rook indicies
-        int rookOccupancyIndicies = (1 << rookRelevantBitCount);
+bool sliderIndexingUsesPext() {
+    return usePext;
+}
 
-        // get the number of bishop indicies
-        int bishopOccupancyIndicies = (1 << bishopRelevantBitCount);
+void initAttackTables() {
+    if (attackTablesInitialized) return;
 
-        //Construct all attacks for this square for the rook
-        for (int index=0; index<rookOccupancyIndicies; index++)
-        {
-            //The rooks occupancy mask
-            U64 roookOccupancy = setOccupancy(index, rookRelevantBitCount, rookAttack);
-            //The rooks magic index
-            int magicIndex = (roookOccupancy * magicR[square]) >> (64 - rookRelevantBits[square]);
-            //Insert the attack into our table
-            rookAttackTable[square][magicIndex] = generateRookAttacks(square, roookOccupancy);
-        }
+    logDebug("Initializing AttackTables");
 
-        //Construct all attacks for this square for the rook
-        for (int index=0; index<bishopOccupancyIndicies; index++)
-        {
-            //The rooks occupancy mask
-            U64 bishopOccupancy = setOccupancy(index, bishopRelevantBitCount, bishopAttack);
-            //The rooks magic index
-            int magicIndex = (bishopOccupancy * magicB[square]) >> (64 - bishopRelevantBits[square]);
-            //Insert the attack into our table
-            bishopAttackTable[square][magicIndex] = generateBishopAttacks(square, bishopOccupancy);
-        }
-    }
+    attackTablesInitialized = true;
+
+    usePext = hasFastPext();
+    buildSliderTables();
+    logInfo("Slider attacks indexed by", usePext ? "pext" : "magics");
+
+    // needs the slider attacks, so it is built last
+    initBetweenTable();
 }
 
 U64 getRookAttacks(int square, U64 occupancy) {
-    occupancy &= rookAttackMasks[square];
-    occupancy *= magicR[square];
-    occupancy >>= 64 - rookRelevantBits[square];
-    return rookAttackTable[square][occupancy];
+    const Magic &magic = rookMagics[square];
+    return magic.attacks[sliderIndex(magic, occupancy)];
 }
 
 U64 getBishopAttacks(int square, U64 occupancy) {
-    occupancy &= bishopAttackMasks[square];
-    occupancy *= magicB[square];
-    occupancy >>= 64 - bishopRelevantBits[square];
-    return bishopAttackTable[square][occupancy];
+    const Magic &magic = bishopMagics[square];
+    return magic.attacks[sliderIndex(magic, occupancy)];
+}
+
+bool checkSliderAttacks() {
+    for (int square = 0; square < 64; square++) {
+        for (int piece : {R, B}) {
+            U64 mask = piece == R ? rookMagics[square].mask : bishopMagics[square].mask;
+
+            // every subset of the mask, once alone and once with the squares outside it filled
+            U64 subset = 0;
+            do {
+                for (U64 occupancy : {subset, subset | ~mask}) {
+                    U64 expected = piece == R ? generateRookAttacks(square, occupancy) : generateBishopAttacks(square, occupancy);
+                    U64 actual = piece == R ? getRookAttacks(square, occupancy) : getBishopAttacks(square, occupancy);
+                    if (expected != actual) return false;
+                }
+                subset = (subset - mask) & mask;
+            } while (subset);
+        }
+    }
+    return true;
 }
 
 U64 getQueenAttacks(int square, U64 occupancy) {
@@ -450,22 +523,64 @@ U64 getQueenAttacks(int square, U64 occupancy) {
 }
 
 inline int getOpponentPiece(ChessBoard &board, int square) {
-    int offset = board.white_to_move?6:0;
-    // go through opponent bitboards
+    // only pieces of the side not to move count
     if (getBit(board.occupancies[board.white_to_move?black:white], square)) {
-        // search opponents bitboards
-        for (int i=0; i<6; i++) {
-            if (getBit(board.bitboards[i + offset], square)) {
-                return (offset + i) % 12;
+        return board.mailbox[square];
+    }
+
+    return no_piece;
+}
+
+
+// squares strictly between two aligned squares, 0 if they do not share a line
+U64 betweenTable[64][64];
+
+void initBetweenTable() {
+    for (int from = 0; from < 64; from++) {
+        for (int to = 0; to < 64; to++) {
+            betweenTable[from][to] = 0ULL;
+            if (from == to) continue;
+
+            if (getRookAttacks(from, 0ULL) & (1ULL << to)) {
+                betweenTable[from][to] = getRookAttacks(from, 1ULL << to) & getRookAttacks(to, 1ULL << from);
+            } else if (getBishopAttacks(from, 0ULL) & (1ULL << to)) {
+                betweenTable[from][to] = getBishopAttacks(from, 1ULL << to) & getBishopAttacks(to, 1ULL << from);
             }
         }
     }
+}
 
-    return no_piece;
+// every piece of attackingSide that attacks square, given the occupancy
+U64 attackersTo(ChessBoard &board, int attackingSide, int square, U64 occupancy) {
+    int offset = attackingSide == white ? 0 : 6;
+
+    return (knightMasks[square] & board.bitboards[N + offset])
+         | (pawnAttackTable[attackingSide^1][square] & board.bitboards[P + offset])
+         | (kingMasks[square] & board.bitboards[K + offset])
+         | (getRookAttacks(square, occupancy) & (board.bitboards[R + offset] | board.bitboards[Q + offset]))
+         | (getBishopAttacks(square, occupancy) & (board.bitboards[B + offset] | board.bitboards[Q + offset]));
 }
 
+// Adds the moves of a piece from square to every destination in targets
+inline void addMoves(ChessBoard &board, Moves &moves, int square, int piece, U64 targets) {
+    while (targets) {
+        int destination = __builtin_ctzll(targets);
+
+        int capturedPiece = no_piece;
+        if ((1ULL << destination) & board.occupancies[board.white_to_move ? black : white]) {
+            capturedPiece = getOpponentPiece(board, destination);
+        }
+
+        moves.list[moves.count++] = encodeMove(square, destination, piece, capturedPiece, no_piece, false, false, false);
+
+        popLsb(targets);
+    }
+}
 
-void generateMoves(ChessBoard &board, Moves &moves) {
+// Generates strictly legal moves. Checkers and pinned pieces are computed once, every
+// piece is then restricted to the squares that resolve a check and stay on its pin ray.
+// type selects all moves, only captures and promotions, or only the remaining quiet moves.
+void generateMoves(ChessBoard &board, Moves &moves, int type) {
 
     if (!attackTablesInitialized) {
         std::cout<<"ERROR: must call initAttackTables() before generating moves"<<std::endl;
@@ -482,27 +597,70 @@ void generateMoves(ChessBoard &board, Moves &moves) {
     } else {
         pawn = P, knight=N, bishop=B, rook=R, queen=Q, king=K;
     }
+    int enemy = side == white ? 6 : 0;
 
-    //KING MOVES
+    // destinations allowed for this type of generation
     U64 emptySquares = ~board.occupancies[side];
+    if (type == GEN_CAPTURES) {
+        emptySquares = board.occupancies[side^1];
+    } else if (type == GEN_QUIETS) {
+        emptySquares = ~board.occupancies[both];
+    }
+    U64 promotionRank = side == white ? 0xFFULL : 0xFF00000000000000ULL;
     int kingSquare = __builtin_ctzll(board.bitboards[king]);
 
-    if (kingSquare < 0 || kingSquare > 63) {
-        writeToLogFile("King is off the board, unexpected behavior may happen. Exiting move generator.");
+    if (board.bitboards[king] == 0ULL) {
+        logError("King is off the board, unexpected behavior may happen. Exiting move generator.");
         return;
     }
 
+    // CHECKS AND PINS
+    U64 checkers = attackersTo(board, side^1, kingSquare, board.occupancies[both]);
+
+    // squares a non king move has to land on, either capturing the checker or blocking it
+    U64 checkMask = ~0ULL;
+    if (checkers) {
+        checkMask = checkers | betweenTable[kingSquare][__builtin_ctzll(checkers)];
+    }
+
+    // enemy sliders that would see the king if our pieces were not in the way
+    U64 pinned = 0ULL;
+    U64 pinRays[64];
+    U64 snipers = (getRookAttacks(kingSquare, board.occupancies[side^1]) & (board.bitboards[R + enemy] | board.bitboards[Q + enemy]))
+                | (getBishopAttacks(kingSquare, board.occupancies[side^1]) & (board.bitboards[B + enemy] | board.bitboards[Q + enemy]));
+    while (snipers) {
+        int sniper = __builtin_ctzll(snipers);
+        U64 blockers = betweenTable[kingSquare][sniper] & board.occupancies[both];
+
+        // exactly one of our own pieces in between means it is pinned
+        if (blockers && (blockers & (blockers - 1)) == 0 && (blockers & board.occupancies[side])) {
+            pinned |= blockers;
+            pinRays[__builtin_ctzll(blockers)] = betweenTable[kingSquare][sniper] | (1ULL << sniper);
+        }
+
+        popLsb(snipers);
+    }
+
+    //KING MOVES
+    // the king is removed from the occupancy so it can not step back along a checking ray
     U64 kingMoves = kingMasks[kingSquare] & emptySquares;
-    // get all of the possible destinations for the king
+    U64 occupancyNoKing = board.occupancies[both] & ~board.bitboards[king];
     while (kingMoves) {
         square = __builtin_ctzll(kingMoves);
 
-        // encode the move
-        int captured_piece = getOpponentPiece(board, square);
-        moves.list[moves.count++] = encodeMove(kingSquare, square, king, captured_piece, no_piece, false, false, false);
+        if (!attackersTo(board, side^1, square, occupancyNoKing)) {
+            // encode the move
+            int captured_piece = getOpponentPiece(board, square);
+            moves.list[moves.count++] = encodeMove(kingSquare, square, king, captured_piece, no_piece, false, false, false);
+        }
         popLsb(kingMoves);
     }
 
+    // in double check only the king can move
+    if (checkers & (checkers - 1)) {
+        return;
+    }
+
 
     // PAWN MOVES
     U64 pawns = board.bitboards[pawn];
@@ -518,6 +676,11 @@ void generateMoves(ChessBoard &board, Moves &moves) {
     while (pawns) {
         square = __builtin_ctzll(pawns);
 
+        U64 legalMask = checkMask;
+        if (getBit(pinned, square)) {
+            legalMask &= pinRays[square];
+        }
+
         // get the procomputed pawn move masks
         singlePushes = pawnSingleTable[side][square] & ~board.occupancies[both];
 
@@ -526,8 +689,17 @@ void generateMoves(ChessBoard &board, Moves &moves) {
             doublePushes = pawnDoubleTable[side][square] & ~board.occupancies[both];
         }
 
-        attacks = pawnAttackTable[side][square] & (board.occupancies[side^1] | enpassantBoard);
-        pawnMoves = singlePushes | doublePushes | attacks;
+        attacks = type == GEN_QUIETS ? 0ULL : pawnAttackTable[side][square] & board.occupancies[side^1];
+
+        // promotions go with the captures, every other push is a quiet move
+        U64 pushes = singlePushes | doublePushes;
+        if (type == GEN_CAPTURES) {
+            pushes &= promotionRank;
+        } else if (type == GEN_QUIETS) {
+            pushes &= ~promotionRank;
+        }
+
+        pawnMoves = (pushes | attacks) & legalMask;
 
         // go through each move and add to list
         while (pawnMoves) {
@@ -551,8 +723,6 @@ void generateMoves(ChessBoard &board, Moves &moves) {
                 moves.list[moves.count++] = encodeMove(square, destination, pawn, capturedPiece, bishop, false, false, false);
                 moves.list[moves.count++] = encodeMove(square, destination, pawn, capturedPiece, queen, false, false, false);
                 moves.list[moves.count++] = encodeMove(square, destination, pawn, capturedPiece, knight, false, false, false);
-            } else if (destination == board.en_passant_square) {
-                moves.list[moves.count++] = encodeMove(square, destination, pawn, capturedPiece, no_piece, true, false, false);
             } else {
                 moves.list[moves.count++] = encodeMove(square, destination, pawn, capturedPiece, no_piece, false, false, abs(square-destination)==16);
             }
@@ -560,94 +730,65 @@ void generateMoves(ChessBoard &board, Moves &moves) {
             popLsb(pawnMoves);
         }
 
+        // en passant removes two pieces from the rank of the king, so the only
+        // safe check is to look at the board as it will be after the capture
+        if (type != GEN_QUIETS && (pawnAttackTable[side][square] & enpassantBoard)) {
+            int capturedSquare = side == white ? board.en_passant_square + 8 : board.en_passant_square - 8;
+
+            if (((enpassantBoard | (1ULL << capturedSquare)) & checkMask)) {
+                U64 occupancy = (board.occupancies[both] ^ (1ULL << square) ^ (1ULL << capturedSquare)) | enpassantBoard;
+
+                if (!(getRookAttacks(kingSquare, occupancy) & (board.bitboards[R + enemy] | board.bitboards[Q + enemy]))
+                    && !(getBishopAttacks(kingSquare, occupancy) & (board.bitboards[B + enemy] | board.bitboards[Q + enemy]))) {
+                    moves.list[moves.count++] = encodeMove(square, board.en_passant_square, pawn, no_piece, no_piece, true, false, false);
+                }
+            }
+        }
+
         popLsb(pawns);
     }
 
 
     // ROOK MOVES
-    U64 rooks = board.bitboards[rook], rookMoves;
+    U64 rooks = board.bitboards[rook];
     while (rooks) {
         int square = __builtin_ctzll(rooks);
-        rookMoves = getRookAttacks(square, board.occupancies[both]) & ~ board.occupancies[side];
-
-        while (rookMoves) {
-            int destination = __builtin_ctzll(rookMoves);
+        U64 legalMask = getBit(pinned, square) ? checkMask & pinRays[square] : checkMask;
 
-            int capturedPiece = no_piece;
-            if ((1ULL << destination) & board.occupancies[side^1]) {
-                capturedPiece = getOpponentPiece(board, destination);
-            }
-
-            moves.list[moves.count++] = encodeMove(square, destination, rook, capturedPiece, no_piece, false, false, false);
-
-            popLsb(rookMoves);
-        }
+        addMoves(board, moves, square, rook, getRookAttacks(square, board.occupancies[both]) & emptySquares & legalMask);
 
         popLsb(rooks);
     }
 
     // BISHOP MOVES
-    U64 bishops = board.bitboards[bishop], bishopMoves;
+    U64 bishops = board.bitboards[bishop];
     while (bishops) {
         int square = __builtin_ctzll(bishops);
-        bishopMoves = getBishopAttacks(square, board.occupancies[both]) & ~ board.occupancies[side];
+        U64 legalMask = getBit(pinned, square) ? checkMask & pinRays[square] : checkMask;
 
-        while (bishopMoves) {
-            int destination = __builtin_ctzll(bishopMoves);
-
-            int capturedPiece = no_piece;
-            if ((1ULL << destination) & board.occupancies[side^1]) {
-                capturedPiece = getOpponentPiece(board, destination);
-            }
-
-            moves.list[moves.count++] = encodeMove(square, destination, bishop, capturedPiece, no_piece, false, false, false);
-
-            popLsb(bishopMoves);
-        }
+        addMoves(board, moves, square, bishop, getBishopAttacks(square, board.occupancies[both]) & emptySquares & legalMask);
 
         popLsb(bishops);
     }
 
     // KNIGHT MOVES
-    U64 knights = board.bitboards[knight], knightMoves;
+    // a pinned knight can never move
+    U64 knights = board.bitboards[knight] & ~pinned;
     while (knights) {
         int square = __builtin_ctzll(knights);
-        knightMoves = knightMasks[square] & emptySquares;
 
-        while (knightMoves) {
-            int destination = __builtin_ctzll(knightMoves);
-
-            int capturedPiece = no_piece;
-            if ((1ULL << destination) & board.occupancies[side^1]) {
-                capturedPiece = getOpponentPiece(board, destination);
-            }
-
-            moves.list[moves.count++] = encodeMove(square, destination, knight, capturedPiece, no_piece, false, false, false);
-
-            popLsb(knightMoves);
-        }
+        addMoves(board, moves, square, knight, knightMasks[square] & emptySquares & checkMask);
 
         popLsb(knights);
     }
 
     // QUEEN MOVES
-    U64 queens = board.bitboards[queen], queenMoves;
+    U64 queens = board.bitboards[queen];
     while (queens) {
         int square = __builtin_ctzll(queens);
-        queenMoves = (getRookAttacks(square, board.occupancies[both]) | getBishopAttacks(square, board.occupancies[both])) & emptySquares;
-
-        while (queenMoves) {
-            int destination = __builtin_ctzll(queenMoves);
-
-            int capturedPiece = no_piece;
-            if ((1ULL << destination) & board.occupancies[side^1]) {
-                capturedPiece = getOpponentPiece(board, destination);
-            }
-
-            moves.list[moves.count++] = encodeMove(square, destination, queen, capturedPiece, no_piece, false, false, false);
+        U64 legalMask = getBit(pinned, square) ? checkMask & pinRays[square] : checkMask;
 
-            popLsb(queenMoves);
-        }
+        addMoves(board, moves, square, queen, getQueenAttacks(square, board.occupancies[both]) & emptySquares & legalMask);
 
         popLsb(queens);
     }
@@ -655,52 +796,122 @@ void generateMoves(ChessBoard &board, Moves &moves) {
 
     enum {wk = 1, wq = 2, bk = 4, bq = 8};
     // CASTLING MOVES
+    // never out of check, and the king may not pass over or land on an attacked square
+    if (checkers || type == GEN_CAPTURES) {
+        return;
+    }
+
     if (side == white) {
-        // if castling is available and king is not in check
-        if ((board.castling_rights & wk) && (board.occupancies[both] & castle_mask_wk) == 0) {
+        if ((board.castling_rights & wk) && (board.occupancies[both] & castle_mask_wk) == 0
+            && !isSquareAttacked(board, black, f1) && !isSquareAttacked(board, black, g1)) {
             moves.list[moves.count++] = encodeMove(e1, g1, king, no_piece, no_piece, false, true, false);
         }
-        if (board.castling_rights & wq && (board.occupancies[both] & castle_piece_mask_wq) == 0 ) {
+        if (board.castling_rights & wq && (board.occupancies[both] & castle_piece_mask_wq) == 0
+            && !isSquareAttacked(board, black, d1) && !isSquareAttacked(board, black, c1)) {
             moves.list[moves.count++] = encodeMove(e1, c1, king, no_piece, no_piece, false, true, false);
         }
     } else {
-        if (board.castling_rights & bk && (board.occupancies[both] & castle_mask_bk) == 0) {
+        if (board.castling_rights & bk && (board.occupancies[both] & castle_mask_bk) == 0
+            && !isSquareAttacked(board, white, f8) && !isSquareAttacked(board, white, g8)) {
             moves.list[moves.count++] = encodeMove(e8, g8, king, no_piece, no_piece, false, true, false);
 
         }
-        if (board.castling_rights & bq && (board.occupancies[both] & castle_piece_mask_bq) == 0 ) {
+        if (board.castling_rights & bq && (board.occupancies[both] & castle_piece_mask_bq) == 0
+            && !isSquareAttacked(board, white, d8) && !isSquareAttacked(board, white, c8)) {
             moves.list[moves.count++] = encodeMove(e8, c8, king, no_piece, no_piece, false, true, false);
         }
     }
 }
 
+bool hasLegalMove(ChessBoard &board) {
+    int side = board.white_to_move ? white : black;
+    int king = board.white_to_move ? K : k;
+    int kingSquare = __builtin_ctzll(board.bitboards[king]);
 
-bool isSquareAttacked(ChessBoard &board, int attackingSide, int square) {
-    int pawn, knight, bishop, rook, queen, king;
-    if (attackingSide == black) {
-        pawn = p, knight=n, bishop=b, rook=r, queen=q, king=k;
-    } else {
-        pawn = P, knight=N, bishop=B, rook=R, queen=Q, king=K;
+    // most positions have a safe king step, which avoids generating anything else
+    U64 kingMoves = kingMasks[kingSquare] & ~board.occupancies[side];
+    U64 occupancyNoKing = board.occupancies[both] & ~board.bitboards[king];
+    while (kingMoves) {
+        if (!attackersTo(board, side^1, __builtin_ctzll(kingMoves), occupancyNoKing)) {
+            return true;
+        }
+        popLsb(kingMoves);
     }
 
-    // place a knight and see if it attacks another opponent knight
-    if (knightMasks[square] & board.bitboards[knight]) return true;
+    Moves moves;
+    generateMoves(board, moves);
+    return moves.count > 0;
+}
 
-    // check if a pawn is on the diagonal side
-    if (pawnAttackTable[attackingSide^1][square] & board.bitboards[pawn]) return true;
+bool isLegalMove(ChessBoard &board, uint32_t move) {
+    if (move == 0) return false;
 
-    // if the other king attacks
-    if (kingMasks[square] & board.bitboards[king]) return true;
+    int from = decodeMoveFrom(move);
+    int to = decodeMoveTo(move);
+    int piece = decodePieceType(move);
+    int captured = decodeCapturePiece(move);
+    int promotion = decodePromotionPiece(move);
+    int side = board.white_to_move ? white : black;
+
+    if (piece >= no_piece || (piece < 6) != board.white_to_move) return false;
+    if (!getBit(board.bitboards[piece], from)) return false;
+
+    // castling and en passant are rare enough to just look them up
+    if (decodeCastling(move) || decodeEnPassantFlag(move)) {
+        Moves moves;
+        generateMoves(board, moves);
+        for (int i = 0; i < moves.count; i++) {
+            if (moves.list[i] == move) return true;
+        }
+        return false;
+    }
 
-    // check if a rook, queen, bishop intersect with queen on kingSquare
-    if (getRookAttacks(square, board.occupancies[both]) & (board.bitboards[rook] | board.bitboards[queen])) return true;
-    if (getBishopAttacks(square, board.occupancies[both]) & (board.bitboards[bishop] | board.bitboards[queen])) return true;
-    
-    return false;
+    // the destination has to hold exactly the piece the move says it captures
+    if (captured == no_piece) {
+        if (getBit(board.occupancies[both], to)) return false;
+    } else if (captured >= no_piece || !getBit(board.bitboards[captured], to) || (captured < 6) == board.white_to_move) {
+        return false;
+    }
+
+    U64 targets = 0ULL;
+    switch (piece % 6) {
+        case P: {
+            if (captured != no_piece) {
+                targets = pawnAttackTable[side][from];
+            } else {
+                targets = pawnSingleTable[side][from] & ~board.occupancies[both];
+                if (targets) targets |= pawnDoubleTable[side][from] & ~board.occupancies[both];
+            }
+            bool promotes = side == white ? to <= h8 : to >= a1;
+            if (promotes != (promotion != no_piece)) return false;
+            if (decodeDoublePushFlag(move) != (abs(from - to) == 16)) return false;
+            break;
+        }
+        case N: targets = knightMasks[from]; break;
+        case B: targets = getBishopAttacks(from, board.occupancies[both]); break;
+        case R: targets = getRookAttacks(from, board.occupancies[both]); break;
+        case Q: targets = getQueenAttacks(from, board.occupancies[both]); break;
+        case K: targets = kingMasks[from]; break;
+    }
+    if (!getBit(targets, to)) return false;
+    if ((piece % 6) != P && (promotion != no_piece || decodeDoublePushFlag(move))) return false;
+
+    // finally make sure our king is not left in check
+    UndoInfo undo;
+    int king = board.white_to_move ? K : k;
+    makeMove(board, move, undo);
+    bool legal = !isSquareAttacked(board, side^1, __builtin_ctzll(board.bitboards[king]));
+    unmakeMove(board, move, undo);
+    return legal;
 }
 
 
-bool makeMove(ChessBoard &board, uint32_t move) {
+bool isSquareAttacked(ChessBoard &board, int attackingSide, int square) {
+    return attackersTo(board, attackingSide, square, board.occupancies[both]) != 0ULL;
+}
+
+
+void makeMove(ChessBoard &board, uint32_t move) {
     int from_square = decodeMoveFrom(move);
     int to_square = decodeMoveTo(move);
     int piece = decodePieceType(move);
@@ -709,16 +920,26 @@ bool makeMove(ChessBoard &board, uint32_t move) {
     int enpassant = decodeEnPassantFlag(move);
     int promotion_piece = decodePromotionPiece(move);
     bool double_push = decodeDoublePushFlag(move);
-    int side = board.white_to_move?white:black;
+    int side = board.white_to_move ? white : black;
+
+    U64 fromTo = (1ULL << from_square) | (1ULL << to_square);
+
+    if (board.accumulator) {
+        updateAccumulator(board, move);
+    }
 
     // Clear the moving piece from the origin square
     popBit(board.bitboards[piece], from_square);
     board.hash ^= piece_keys[piece][from_square];
+    board.mailbox[from_square] = no_piece;
+    board.occupancies[side] ^= fromTo;
 
     // Remove the captured piece if any
     if (captured_piece != no_piece) {
         popBit(board.bitboards[captured_piece], to_square);
+        removePieceScore(board, captured_piece, to_square);
         board.hash ^= piece_keys[captured_piece][to_square];
+        board.occupancies[side^1] ^= 1ULL << to_square;
     }
 
     
@@ -726,26 +947,33 @@ bool makeMove(ChessBoard &board, uint32_t move) {
     if (promotion_piece != no_piece) {
         setBit(board.bitboards[promotion_piece], to_square);
         board.hash ^= piece_keys[promotion_piece][to_square];
-    
+        board.mailbox[to_square] = promotion_piece;
+        removePieceScore(board, piece, from_square);
+        addPieceScore(board, promotion_piece, to_square);
 
     } else if (enpassant) {
         // En passant special move
-        if (board.white_to_move) {
-            popBit(board.bitboards[p], to_square + 8);
-            board.hash ^= piece_keys[p][to_square + 8];
+        int captured_square = board.white_to_move ? to_square + 8 : to_square - 8;
+        int captured_pawn = board.white_to_move ? p : P;
+
+        popBit(board.bitboards[captured_pawn], captured_square);
+        board.hash ^= piece_keys[captured_pawn][captured_square];
+        board.mailbox[captured_square] = no_piece;
+        board.occupancies[side^1] ^= 1ULL << captured_square;
+        removePieceScore(board, captured_pawn, captured_square);
 
-        } else {
-            popBit(board.bitboards[P], to_square - 8);
-            board.hash ^= piece_keys[P][to_square - 8];
-        }
         // Set the moving piece in the destination square
         setBit(board.bitboards[piece], to_square);
         board.hash ^= piece_keys[piece][to_square];
+        board.mailbox[to_square] = piece;
+        movePieceScore(board, piece, from_square, to_square);
 
     } else {
         // Set the moving piece in the destination square
         setBit(board.bitboards[piece], to_square);
         board.hash ^= piece_keys[piece][to_square];
+        board.mailbox[to_square] = piece;
+        movePieceScore(board, piece, from_square, to_square);
     }
 
     board.hash ^= enpassant_keys[board.en_passant_square];
@@ -762,161 +990,215 @@ bool makeMove(ChessBoard &board, uint32_t move) {
     }
     board.hash ^= enpassant_keys[board.en_passant_square];
 
-    // Update castling rights
+    // Move the rook when castling
     if (castling) {
-            switch (to_square) {
-                case g1:
-                    if (isSquareAttacked(board, black, f1) || isSquareAttacked(board, black, g1) || isSquareAttacked(board, black, e1)) 
-                        return false;
-                    popBit(board.bitboards[R], h1);
-                    setBit(board.bitboards[R], f1);
-                    board.hash ^= piece_keys[R][h1];
-                    board.hash ^= piece_keys[R][f1];
-                    break;
-                case c1:
-                    if (isSquareAttacked(board, black, c1) || isSquareAttacked(board, black, d1) || isSquareAttacked(board, black, e1)) 
-                        return false;
-                    popBit(board.bitboards[R], a1);
-                    setBit(board.bitboards[R], d1);
-                    board.hash ^= piece_keys[R][a1];
-                    board.hash ^= piece_keys[R][d1];
-                    break;
-                case g8:
-                    if (isSquareAttacked(board, white, f8) || isSquareAttacked(board, white, g8) || isSquareAttacked(board, white, e8)) 
-                        return false;
-                    popBit(board.bitboards[r], h8);
-                    setBit(board.bitboards[r], f8);
-                    board.hash ^= piece_keys[r][h8];
-                    board.hash ^= piece_keys[r][f8];
-                    break;
-                case c8:
-                    if (isSquareAttacked(board, white, c8) || isSquareAttacked(board, white, d8) || isSquareAttacked(board, white, e8)) 
-                        return false;
-                    popBit(board.bitboards[r], a8);
-                    setBit(board.bitboards[r], d8);
-                    board.hash ^= piece_keys[r][a8];
-                    board.hash ^= piece_keys[r][d8];
-                    break;
-            }
+        int rook = board.white_to_move ? R : r;
+        int rook_from, rook_to;
+        switch (to_square) {
+            case g1: rook_from = h1; rook_to = f1; break;
+            case c1: rook_from = a1; rook_to = d1; break;
+            case g8: rook_from = h8; rook_to = f8; break;
+            default: rook_from = a8; rook_to = d8; break;
         }
 
+        popBit(board.bitboards[rook], rook_from);
+        setBit(board.bitboards[rook], rook_to);
+        board.hash ^= piece_keys[rook][rook_from];
+        board.hash ^= piece_keys[rook][rook_to];
+        board.mailbox[rook_from] = no_piece;
+        board.mailbox[rook_to] = rook;
+        board.occupancies[side] ^= (1ULL << rook_from) | (1ULL << rook_to);
+        movePieceScore(board, rook, rook_from, rook_to);
+    }
+
+    // Update castling rights
     board.hash ^= castling_keys[board.castling_rights];
     board.castling_rights &= castling_rights[from_square];
     board.castling_rights &= castling_rights[to_square];
     board.hash ^= castling_keys[board.castling_rights];
 
-
-    board.occupancies[white] = 0;
-    board.occupancies[black] = 0;
-    // loop over white pieces bitboards
-    for (int bb_piece = P; bb_piece <= K; bb_piece++)
-        board.occupancies[white] |= board.bitboards[bb_piece];
-
-    // loop over black pieces bitboards
-    for (int bb_piece = p; bb_piece <= k; bb_piece++)
-        board.occupancies[black] |= board.bitboards[bb_piece];
-
     // update both sides occupancies
     board.occupancies[both] = (board.occupancies[white] | board.occupancies[black]);
 
+    // the pawn key only changes when a pawn moves, promotes or is captured
+    if (piece == P || piece == p) {
+        board.pawn_hash ^= piece_keys[piece][from_square];
+        if (promotion_piece == no_piece) {
+            board.pawn_hash ^= piece_keys[piece][to_square];
+        }
+    }
+    if (captured_piece == P || captured_piece == p) {
+        board.pawn_hash ^= piece_keys[captured_piece][to_square];
+    } else if (enpassant) {
+        int captured_square = board.white_to_move ? to_square + 8 : to_square - 8;
+        board.pawn_hash ^= piece_keys[board.white_to_move ? p : P][captured_square];
+    }
+
+    // pawn moves and captures can not be taken back, they restart the fifty move count
+    if (piece == P || piece == p || captured_piece != no_piece) {
+        board.half_move_counter = 0;
+    } else {
+        board.half_move_counter++;
+    }
+    if (!board.white_to_move) {
+        board.full_move_counter++;
+    }
+
     // Swap side to move
     board.hash ^= side_key;
     board.white_to_move = !board.white_to_move;
+}
 
-
-    // make sure that king is not exposed into a check
-    int kingSquare = __builtin_ctzll(board.white_to_move?board.bitboards[k]:board.bitboards[K]);
-    if (isSquareAttacked(board, board.white_to_move?white:black, kingSquare))
-    {   
-        // return illegal move
-        return false;
-    }
-    
-    return true;
+void makeMove(ChessBoard &board, uint32_t move, UndoInfo &undo) {
+#ifdef COPY_MAKE
+    undo.board = board;
+#else
+    undo.hash = board.hash;
+    undo.pawn_hash = board.pawn_hash;
+    undo.half_move_counter = board.half_move_counter;
+    undo.en_passant_square = board.en_passant_square;
+    undo.castling_rights = board.castling_rights;
+    undo.captured_piece = decodeCapturePiece(move);
+    undo.mg_score = board.mg_score;
+    undo.eg_score = board.eg_score;
+    undo.phase = board.phase;
+#endif
+
+    makeMove(board, move);
 }
 
-int getPieceOnSquare(ChessBoard &board, int square) {
-    for (int index = 0; index < 12; index++) {
-        U64 bitboard = board.bitboards[index];
-        if (getBit(bitboard, square)) return index;
+void unmakeMove(ChessBoard &board, uint32_t move, const UndoInfo &undo) {
+#ifdef COPY_MAKE
+    board = undo.board;
+#else
+    int from_square = decodeMoveFrom(move);
+    int to_square = decodeMoveTo(move);
+    int piece = decodePieceType(move);
+    int promotion_piece = decodePromotionPiece(move);
+
+    // the side that made the move
+    board.white_to_move = !board.white_to_move;
+    int side = board.white_to_move ? white : black;
+    if (!board.white_to_move) {
+        board.full_move_counter--;
     }
-    return no_piece;
-}
 
-uint32_t parseMove(ChessBoard &board, const std::string &move) {
-    int from = (move[0] - 'a') + (8 - (move[1] - '0')) * 8;
-    int to = (move[2] - 'a') + (8 - (move[3] - '0')) * 8;
-    
-    int piece = getPieceOnSquare(board, from);
-
-    if (piece == no_piece) {
-        writeToLogFile("Tried to move piece that doesn't exist:", move);
-    }
-
-    // if theres a promotion piece
-    int promotionPiece = no_piece;
-    if (move.length() == 5) {
-        switch (move[4]) {
-            case 'r':
-                promotionPiece = r;
-                break;
-            case 'b':
-                promotionPiece = b;
-                break;
-            case 'q':
-                promotionPiece = q;
-                break;
-            case 'n':
-                promotionPiece = n;
-                break;
-            case 'R':
-                promotionPiece = R;
-                break;
-            case 'B':
-                promotionPiece = B;
-                break;
-            case 'Q':
-                promotionPiece = Q;
-                break;
-            case 'N':
-                promotionPiece = N;
-                break;
+    U64 fromTo = (1ULL << from_square) | (1ULL << to_square);
+
+    // take the piece (or what it promoted to) off the destination and put it back
+    popBit(board.bitboards[promotion_piece != no_piece ? promotion_piece : piece], to_square);
+    setBit(board.bitboards[piece], from_square);
+    board.mailbox[from_square] = piece;
+    board.mailbox[to_square] = no_piece;
+    board.occupancies[side] ^= fromTo;
+
+    if (undo.captured_piece != no_piece) {
+        setBit(board.bitboards[undo.captured_piece], to_square);
+        board.mailbox[to_square] = undo.captured_piece;
+        board.occupancies[side^1] ^= 1ULL << to_square;
+
+    } else if (decodeEnPassantFlag(move)) {
+        int captured_square = board.white_to_move ? to_square + 8 : to_square - 8;
+        int captured_pawn = board.white_to_move ? p : P;
+
+        setBit(board.bitboards[captured_pawn], captured_square);
+        board.mailbox[captured_square] = captured_pawn;
+        board.occupancies[side^1] ^= 1ULL << captured_square;
+
+    } else if (decodeCastling(move)) {
+        int rook = board.white_to_move ? R : r;
+        int rook_from, rook_to;
+        switch (to_square) {
+            case g1: rook_from = h1; rook_to = f1; break;
+            case c1: rook_from = a1; rook_to = d1; break;
+            case g8: rook_from = h8; rook_to = f8; break;
+            default: rook_from = a8; rook_to = d8; break;
         }
+
+        popBit(board.bitboards[rook], rook_to);
+        setBit(board.bitboards[rook], rook_from);
+        board.mailbox[rook_to] = no_piece;
+        board.mailbox[rook_from] = rook;
+        board.occupancies[side] ^= (1ULL << rook_from) | (1ULL << rook_to);
     }
-    
-    bool castling = false;
-    bool doublePush = false;
-    if (piece == k || piece == K) {
-        if (abs(to - from) == 2) {
-            castling = true;
-        }
-    } else if (piece == p || piece == P) {
-        if (abs(from - to) == 16) {
-            doublePush = true;
-        }
+
+    board.occupancies[both] = (board.occupancies[white] | board.occupancies[black]);
+
+    board.hash = undo.hash;
+    board.pawn_hash = undo.pawn_hash;
+    board.half_move_counter = undo.half_move_counter;
+    board.en_passant_square = undo.en_passant_square;
+    board.castling_rights = undo.castling_rights;
+    board.mg_score = undo.mg_score;
+    board.eg_score = undo.eg_score;
+    board.phase = undo.phase;
+
+    // the accumulator before the move is still one entry down the stack
+    if (board.accumulator) {
+        board.accumulator--;
     }
+#endif
+}
+
+void makeNullMove(ChessBoard &board, UndoInfo &undo) {
+    undo.hash = board.hash;
+    undo.en_passant_square = board.en_passant_square;
+    undo.half_move_counter = board.half_move_counter;
+
+    // nothing before a null move can repeat after it
+    board.half_move_counter = 0;
+
+    board.hash ^= enpassant_keys[board.en_passant_square];
+    board.en_passant_square = no_square;
+    board.hash ^= enpassant_keys[board.en_passant_square];
 
-    U64 encodedMove = encodeMove(
-        from, 
-        to, 
-        piece, 
-        getPieceOnSquare(board, to), 
-        promotionPiece, 
-        (to==board.en_passant_square), 
-        castling,
-        doublePush
-        );
+    board.hash ^= side_key;
+    board.white_to_move = !board.white_to_move;
+}
 
-    return encodedMove;
+void unmakeNullMove(ChessBoard &board, const UndoInfo &undo) {
+    board.white_to_move = !board.white_to_move;
+    board.hash = undo.hash;
+    board.en_passant_square = undo.en_passant_square;
+    board.half_move_counter = undo.half_move_counter;
 }
 
+int countLegalMoves(ChessBoard &board) {
+    Moves moves;
+    generateMoves(board, moves);
+    return moves.count;
+}
+
+static std::string lowerCase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+uint32_t parseMove(ChessBoard &board, const std::string &move) {
+    // the move generator knows the piece, the flags and the colour of the promotion piece,
+    // the notation only has to name the squares and the promotion type in either case
+    std::string wanted = lowerCase(move);
+
+    Moves moves;
+    generateMoves(board, moves);
+    for (int i = 0; i < moves.count; i++) {
+        if (lowerCase(moveToString(moves.list[i])) == wanted) {
+            return moves.list[i];
+        }
+    }
+
+    logError("Illegal move:", move);
+    return 0;
+}
 
 void parseMoves(ChessBoard &board, const std::string &moves) {
-    writeToLogFile("Parsing moves:", moves);
+    logDebug("Parsing moves:", moves);
     std::stringstream ss(moves);
     std::string move;
 
     while (ss >> move) {
-        parseMove(board, move);
+        uint32_t parsed = parseMove(board, move);
+        if (!parsed) break;
+        makeMove(board, parsed);
     }
 }
\ No newline at end of file
@@ -35,21 +35,93 @@ struct Moves {
 
 
 
-void generateMoves(ChessBoard &board, Moves &moves);
+// what generateMoves produces, captures include every promotion
+enum {GEN_ALL, GEN_CAPTURES, GEN_QUIETS};
+
+// generates only legal moves, when in check only the evasions
+void generateMoves(ChessBoard &board, Moves &moves, int type = GEN_ALL);
+
+inline void generateCaptures(ChessBoard &board, Moves &moves) {
+    generateMoves(board, moves, GEN_CAPTURES);
+}
+
+inline void generateQuiets(ChessBoard &board, Moves &moves) {
+    generateMoves(board, moves, GEN_QUIETS);
+}
+
+// only valid in check, every legal move is then an evasion
+inline void generateEvasions(ChessBoard &board, Moves &moves) {
+    generateMoves(board, moves, GEN_ALL);
+}
+
+// checks a move from another source (transposition table, killers) against the position
+bool isLegalMove(ChessBoard &board, uint32_t move);
+
+// true if the side to move has at least one legal move, cheaper than generating them all
+bool hasLegalMove(ChessBoard &board);
 
 
 void initAttackTables();
 
+// true when the cpu has bmi2 and pext is fast, it is microcoded on amd before zen 3
+bool hasFastPext();
+
+// Rebuilds the slider tables for pext or magic indexing and returns whether pext is in use.
+// initAttackTables picks pext when hasFastPext(), it is only compiled in with -mbmi2.
+bool setSliderIndexing(bool pext);
+
+bool sliderIndexingUsesPext();
+
+// compares every slider table entry with the attacks computed ray by ray
+bool checkSliderAttacks();
+
+// slider attacks from square with the given blockers, through the magic or pext tables
+U64 getRookAttacks(int square, U64 occupancy);
+U64 getBishopAttacks(int square, U64 occupancy);
+U64 getQueenAttacks(int square, U64 occupancy);
+
 bool isSquareAttacked(ChessBoard &board, int attackingSide, int square);
 
-bool makeMove(ChessBoard &board, uint32_t move);
+// Everything makeMove can not recover from the move itself. Search and perft keep one
+// per ply and take moves back with unmakeMove instead of copying the whole board.
+// Building with -DCOPY_MAKE stores a copy of the board instead, so both can be measured.
+struct UndoInfo {
+    U64 hash;
+    U64 pawn_hash;
+    int mg_score;
+    int eg_score;
+    int phase;
+    unsigned half_move_counter;
+    int en_passant_square;
+    uint8_t castling_rights;
+    uint8_t captured_piece;
+#ifdef COPY_MAKE
+    ChessBoard board;
+#endif
+};
+
+// the move has to be legal, the generator only produces legal moves
+void makeMove(ChessBoard &board, uint32_t move);
+
+void makeMove(ChessBoard &board, uint32_t move, UndoInfo &undo);
+
+// takes back a move made with the undo record filled by makeMove
+void unmakeMove(ChessBoard &board, uint32_t move, const UndoInfo &undo);
 
+// passes the turn to the opponent, only the search uses this for null move pruning
+void makeNullMove(ChessBoard &board, UndoInfo &undo);
+
+void unmakeNullMove(ChessBoard &board, const UndoInfo &undo);
+
+// number of legal moves in the position, used for bulk counting at the leaves
+int countLegalMoves(ChessBoard &board);
+
+// plays the moves in turn, stops at the first one that is not legal
 void parseMoves(ChessBoard &board, const std::string &moves);
 
+// the legal move the uci notation names, 0 when there is none
 uint32_t parseMove(ChessBoard &board, const std::string &move);
 
 inline int getOpponentPiece(ChessBoard &board, int square);
 
-void sortMoves(std::vector<uint32_t> &moves);
-
 #endif
\ No newline at end of file
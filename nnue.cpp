@@ -0,0 +1,276 @@
+#include "nnue.h"
+#include "utils.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+Network network;
+bool networkLoaded = false;
+bool useNNUE = false;
+
+// row of the feature weights for a piece on a square seen from perspective
+static inline int featureIndex(int perspective, int piece, int square) {
+    bool own = (piece < 6) == (perspective == white);
+    int relative = perspective == white ? square ^ 56 : square;
+    return ((own ? 0 : 6) + piece % 6) * 64 + relative;
+}
+
+// out = in + the added rows - the removed rows, in and out may be the same
+static inline void applyDeltas(const int16_t *in, int16_t *out,
+                               const int16_t *const *added, int addCount,
+                               const int16_t *const *removed, int removeCount) {
+#if defined(__AVX2__)
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i *>(in + i));
+        for (int j = 0; j < addCount; j++) {
+            v = _mm256_add_epi16(v, _mm256_load_si256(reinterpret_cast<const __m256i *>(added[j] + i)));
+        }
+        for (int j = 0; j < removeCount; j++) {
+            v = _mm256_sub_epi16(v, _mm256_load_si256(reinterpret_cast<const __m256i *>(removed[j] + i)));
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i *>(out + i), v);
+    }
+#elif defined(__SSE4_1__)
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i v = _mm_load_si128(reinterpret_cast<const __m128i *>(in + i));
+        for (int j = 0; j < addCount; j++) {
+            v = _mm_add_epi16(v, _mm_load_si128(reinterpret_cast<const __m128i *>(added[j] + i)));
+        }
+        for (int j = 0; j < removeCount; j++) {
+            v = _mm_sub_epi16(v, _mm_load_si128(reinterpret_cast<const __m128i *>(removed[j] + i)));
+        }
+        _mm_store_si128(reinterpret_cast<__m128i *>(out + i), v);
+    }
+#else
+    // one row at a time keeps the inner loops simple enough for the compiler to vectorise
+    if (in != out) {
+        std::copy(in, in + NNUE_HIDDEN, out);
+    }
+    for (int j = 0; j < addCount; j++) {
+        for (int i = 0; i < NNUE_HIDDEN; i++) out[i] += added[j][i];
+    }
+    for (int j = 0; j < removeCount; j++) {
+        for (int i = 0; i < NNUE_HIDDEN; i++) out[i] -= removed[j][i];
+    }
+#endif
+}
+
+bool loadNetwork(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        logWarning("Unable to open network file", path);
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0, hidden = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(&hidden), sizeof(hidden));
+    if (!file || std::memcmp(magic, "BMNN", 4) != 0 || version != NNUE_VERSION || hidden != NNUE_HIDDEN) {
+        logWarning("Not a supported network file", path);
+        return false;
+    }
+
+    // read into a scratch copy so a truncated file leaves the current network intact
+    std::unique_ptr<Network> loaded(new Network);
+    file.read(reinterpret_cast<char *>(loaded->featureWeights), sizeof(loaded->featureWeights));
+    file.read(reinterpret_cast<char *>(loaded->featureBiases), sizeof(loaded->featureBiases));
+    file.read(reinterpret_cast<char *>(loaded->outputWeights), sizeof(loaded->outputWeights));
+    file.read(reinterpret_cast<char *>(&loaded->outputBias), sizeof(loaded->outputBias));
+    if (!file || file.peek() != std::char_traits<char>::eof()) {
+        logWarning("Network file has the wrong size", path);
+        return false;
+    }
+
+    network = *loaded;
+    networkLoaded = true;
+    logInfo("Loaded network", path, "kernels", nnueKernelName());
+    return true;
+}
+
+void randomNetwork(uint64_t seed) {
+    std::mt19937_64 rng(seed);
+
+    // small enough that 32 pieces can never overflow an accumulator
+    for (auto &row : network.featureWeights) {
+        for (int16_t &weight : row) weight = static_cast<int16_t>(rng() % 65) - 32;
+    }
+    for (int16_t &bias : network.featureBiases) bias = static_cast<int16_t>(rng() % 129) - 64;
+    for (int8_t &weight : network.outputWeights) weight = static_cast<int8_t>(static_cast<int>(rng() % 129) - 64);
+    network.outputBias = static_cast<int32_t>(rng() % 2001) - 1000;
+
+    networkLoaded = true;
+}
+
+void refreshAccumulator(const ChessBoard &board, Accumulator &accumulator) {
+    for (int perspective = white; perspective <= black; perspective++) {
+        std::copy(std::begin(network.featureBiases), std::end(network.featureBiases), accumulator.values[perspective]);
+
+        for (int piece = P; piece <= k; piece++) {
+            U64 bb = board.bitboards[piece];
+            while (bb) {
+                const int16_t *row = network.featureWeights[featureIndex(perspective, piece, __builtin_ctzll(bb))];
+                applyDeltas(accumulator.values[perspective], accumulator.values[perspective], &row, 1, nullptr, 0);
+                popLsb(bb);
+            }
+        }
+    }
+}
+
+void updateAccumulator(ChessBoard &board, uint32_t move) {
+    int from = decodeMoveFrom(move);
+    int to = decodeMoveTo(move);
+    int piece = decodePieceType(move);
+    int captured = decodeCapturePiece(move);
+    int promotion = decodePromotionPiece(move);
+
+    // a move adds at most two pieces and removes at most two, castling moves the rook as well
+    int addPieces[2], addSquares[2], removePieces[2], removeSquares[2];
+    int addCount = 0, removeCount = 0;
+
+    removePieces[removeCount] = piece; removeSquares[removeCount++] = from;
+    addPieces[addCount] = promotion != no_piece ? promotion : piece; addSquares[addCount++] = to;
+
+    if (captured != no_piece) {
+        removePieces[removeCount] = captured; removeSquares[removeCount++] = to;
+    } else if (decodeEnPassantFlag(move)) {
+        removePieces[removeCount] = piece == P ? p : P;
+        removeSquares[removeCount++] = piece == P ? to + 8 : to - 8;
+    } else if (decodeCastling(move)) {
+        int rook = piece == K ? R : r;
+        int rookFrom, rookTo;
+        switch (to) {
+            case g1: rookFrom = h1; rookTo = f1; break;
+            case c1: rookFrom = a1; rookTo = d1; break;
+            case g8: rookFrom = h8; rookTo = f8; break;
+            default: rookFrom = a8; rookTo = d8; break;
+        }
+        removePieces[removeCount] = rook; removeSquares[removeCount++] = rookFrom;
+        addPieces[addCount] = rook; addSquares[addCount++] = rookTo;
+    }
+
+    const Accumulator &previous = *board.accumulator;
+    Accumulator &next = *++board.accumulator;
+
+    for (int perspective = white; perspective <= black; perspective++) {
+        const int16_t *added[2], *removed[2];
+        for (int i = 0; i < addCount; i++) {
+            added[i] = network.featureWeights[featureIndex(perspective, addPieces[i], addSquares[i])];
+        }
+        for (int i = 0; i < removeCount; i++) {
+            removed[i] = network.featureWeights[featureIndex(perspective, removePieces[i], removeSquares[i])];
+        }
+        applyDeltas(previous.values[perspective], next.values[perspective], added, addCount, removed, removeCount);
+    }
+}
+
+static inline int scaleOutput(int64_t sum) {
+    int64_t score = (sum + network.outputBias) * NNUE_SCALE / (NNUE_QA * NNUE_QB);
+    return static_cast<int>(std::clamp<int64_t>(score, -NNUE_MAX_SCORE, NNUE_MAX_SCORE));
+}
+
+int nnueOutputScalar(const Accumulator &accumulator, bool white_to_move) {
+    const int16_t *halves[2] = {accumulator.values[white_to_move ? white : black],
+                                accumulator.values[white_to_move ? black : white]};
+
+    int64_t sum = 0;
+    for (int half = 0; half < 2; half++) {
+        const int8_t *weights = network.outputWeights + half * NNUE_HIDDEN;
+        for (int i = 0; i < NNUE_HIDDEN; i++) {
+            int activation = std::clamp<int>(halves[half][i], 0, NNUE_QA);
+            sum += activation * weights[i];
+        }
+    }
+    return scaleOutput(sum);
+}
+
+int nnueOutput(const Accumulator &accumulator, bool white_to_move) {
+#if defined(__AVX2__) || defined(__SSE4_1__)
+    const int16_t *halves[2] = {accumulator.values[white_to_move ? white : black],
+                                accumulator.values[white_to_move ? black : white]};
+#endif
+
+#if defined(__AVX2__)
+    // clip 32 activations to [0, 127], pack them to unsigned bytes and multiply with the
+    // signed byte weights, adjacent products are summed to 16 bits (at most 2 * 127 * 128)
+    // and then to 32 bits
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i clip = _mm256_set1_epi16(NNUE_QA);
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int half = 0; half < 2; half++) {
+        const int8_t *weights = network.outputWeights + half * NNUE_HIDDEN;
+        for (int i = 0; i < NNUE_HIDDEN; i += 32) {
+            __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i *>(halves[half] + i));
+            __m256i high = _mm256_load_si256(reinterpret_cast<const __m256i *>(halves[half] + i + 16));
+            low = _mm256_min_epi16(_mm256_max_epi16(low, zero), clip);
+            high = _mm256_min_epi16(_mm256_max_epi16(high, zero), clip);
+
+            // packus works within 128 bit lanes, the permute restores the element order
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8);
+            __m256i w = _mm256_load_si256(reinterpret_cast<const __m256i *>(weights + i));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(packed, w), ones));
+        }
+    }
+
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0x4E));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0xB1));
+    return scaleOutput(_mm_cvtsi128_si32(sum128));
+
+#elif defined(__SSE4_1__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i clip = _mm_set1_epi16(NNUE_QA);
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+
+    for (int half = 0; half < 2; half++) {
+        const int8_t *weights = network.outputWeights + half * NNUE_HIDDEN;
+        for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+            __m128i low = _mm_load_si128(reinterpret_cast<const __m128i *>(halves[half] + i));
+            __m128i high = _mm_load_si128(reinterpret_cast<const __m128i *>(halves[half] + i + 8));
+            low = _mm_min_epi16(_mm_max_epi16(low, zero), clip);
+            high = _mm_min_epi16(_mm_max_epi16(high, zero), clip);
+
+            __m128i packed = _mm_packus_epi16(low, high);
+            __m128i w = _mm_load_si128(reinterpret_cast<const __m128i *>(weights + i));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(packed, w), ones));
+        }
+    }
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return scaleOutput(_mm_cvtsi128_si32(sum));
+
+#else
+    return nnueOutputScalar(accumulator, white_to_move);
+#endif
+}
+
+int evaluateNNUE(const ChessBoard &board) {
+    if (board.accumulator) {
+        return nnueOutput(*board.accumulator, board.white_to_move);
+    }
+
+    Accumulator accumulator;
+    refreshAccumulator(board, accumulator);
+    return nnueOutput(accumulator, board.white_to_move);
+}
+
+const char *nnueKernelName() {
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE4_1__)
+    return "sse4.1";
+#else
+    return "scalar";
+#endif
+}
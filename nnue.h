@@ -0,0 +1,88 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include "engine.h"
+#include <string>
+
+// Efficiently updatable network, 768 -> 2x256 -> 1.
+//
+// Inputs are one feature per (piece, square) seen from each side: the side's own pieces
+// come first, and black sees the board flipped vertically so both halves use the same
+// weights. The first layer output for each side is kept in an accumulator that makeMove
+// updates from the pieces that moved instead of recomputing it. The output layer takes
+// the side to move's half followed by the other half, clipped to [0, NNUE_QA].
+//
+// Network file, little endian, nothing between the fields:
+//
+//     char     magic[4]                       "BMNN"
+//     uint32   version                        NNUE_VERSION
+//     uint32   hidden size                    NNUE_HIDDEN
+//     int16    feature weights[768][256]      feature = (own ? 0 : 6) * 64 + piece type * 64 + square,
+//                                             squares from a1 = 0 to h8 = 63, scaled by NNUE_QA
+//     int16    feature biases[256]            scaled by NNUE_QA
+//     int8     output weights[512]            side to move half first, scaled by NNUE_QB
+//     int32    output bias                    scaled by NNUE_QA * NNUE_QB
+//
+// The score in centipawns is (output weights . activations + output bias) * NNUE_SCALE / (NNUE_QA * NNUE_QB).
+
+constexpr uint32_t NNUE_VERSION = 1;
+constexpr int NNUE_INPUTS = 768;
+constexpr int NNUE_HIDDEN = 256;
+constexpr int NNUE_QA = 127;
+constexpr int NNUE_QB = 64;
+constexpr int NNUE_SCALE = 400;
+
+// network scores are kept clear of the mate range and fit the eval cache
+constexpr int NNUE_MAX_SCORE = 20000;
+
+// first layer output of both sides, indexed by white / black
+struct alignas(64) Accumulator {
+    int16_t values[2][NNUE_HIDDEN];
+};
+
+struct alignas(64) Network {
+    int16_t featureWeights[NNUE_INPUTS][NNUE_HIDDEN];
+    int16_t featureBiases[NNUE_HIDDEN];
+    int8_t outputWeights[2 * NNUE_HIDDEN];
+    int32_t outputBias;
+};
+
+extern Network network;
+
+// a network has been loaded (or generated for testing)
+extern bool networkLoaded;
+
+// the uci option, only honoured once a network is loaded
+extern bool useNNUE;
+
+inline bool nnueEnabled() {
+    return useNNUE && networkLoaded;
+}
+
+// reads a network file in the format above, the current network is kept when it fails
+bool loadNetwork(const std::string &path);
+
+// fills the network with deterministic noise, only meant to exercise the code without a file
+void randomNetwork(uint64_t seed);
+
+// computes both halves of the accumulator from scratch
+void refreshAccumulator(const ChessBoard &board, Accumulator &accumulator);
+
+// Called by makeMove before the board changes when it has an accumulator stack: the next
+// entry becomes the current one with the pieces of the move removed and added.
+// unmakeMove only has to step back to the previous entry.
+void updateAccumulator(ChessBoard &board, uint32_t move);
+
+// network output for the side to move, the vectorised kernel of the build
+int nnueOutput(const Accumulator &accumulator, bool white_to_move);
+
+// plain c++ version of nnueOutput, the reference for the vectorised kernels
+int nnueOutputScalar(const Accumulator &accumulator, bool white_to_move);
+
+// uses the board's accumulator when it has one, otherwise builds a temporary
+int evaluateNNUE(const ChessBoard &board);
+
+// name of the kernels compiled in, for the logs
+const char *nnueKernelName();
+
+#endif
@@ -0,0 +1,121 @@
+#include "pawns.h"
+#include "moves.h"
+
+// penalties and bonuses as {middlegame, endgame}
+const int doubled_penalty[2] = {-10, -20};
+const int isolated_penalty[2] = {-10, -15};
+const int backward_penalty[2] = {-8, -10};
+
+// passed pawn bonus by rank as seen from the pawn's side, rank 1 first
+const int passed_bonus_mg[8] = {0, 5, 10, 15, 25, 40, 60, 0};
+const int passed_bonus_eg[8] = {0, 10, 20, 35, 60, 100, 150, 0};
+
+U64 fileMasks[8];
+U64 adjacentFileMasks[8];
+U64 forwardMasks[2][64];    // squares in front of a pawn on its own file
+U64 passedMasks[2][64];     // squares in front on its own and the adjacent files
+U64 attackSpanMasks[2][64]; // squares in front on the adjacent files
+U64 pawnAttackMasks[2][64];
+
+static bool pawnTablesInitialized = false;
+
+void initPawnTables() {
+    if (pawnTablesInitialized) return;
+    pawnTablesInitialized = true;
+
+    for (int file = 0; file < 8; file++) {
+        fileMasks[file] = 0x0101010101010101ULL << file;
+    }
+    for (int file = 0; file < 8; file++) {
+        adjacentFileMasks[file] = (file > 0 ? fileMasks[file - 1] : 0) | (file < 7 ? fileMasks[file + 1] : 0);
+    }
+
+    for (int square = 0; square < 64; square++) {
+        int file = square & 7;
+        int row = square >> 3;
+
+        // white moves towards a8, the lower rows
+        U64 aboveRows = row > 0 ? ~0ULL >> (64 - 8 * row) : 0ULL;
+        U64 belowRows = row < 7 ? ~0ULL << (8 * (row + 1)) : 0ULL;
+
+        forwardMasks[white][square] = fileMasks[file] & aboveRows;
+        forwardMasks[black][square] = fileMasks[file] & belowRows;
+        attackSpanMasks[white][square] = adjacentFileMasks[file] & aboveRows;
+        attackSpanMasks[black][square] = adjacentFileMasks[file] & belowRows;
+        passedMasks[white][square] = forwardMasks[white][square] | attackSpanMasks[white][square];
+        passedMasks[black][square] = forwardMasks[black][square] | attackSpanMasks[black][square];
+
+        U64 bit = 1ULL << square;
+        pawnAttackMasks[white][square] = ((bit >> 7) & NOT_A_FILE) | ((bit >> 9) & NOT_H_FILE);
+        pawnAttackMasks[black][square] = ((bit << 9) & NOT_A_FILE) | ((bit << 7) & NOT_H_FILE);
+    }
+}
+
+U64 pawnHash(const ChessBoard &board) {
+    U64 hash = 0;
+
+    for (int piece : {P, p}) {
+        U64 bb = board.bitboards[piece];
+        while (bb) {
+            hash ^= piece_keys[piece][__builtin_ctzll(bb)];
+            bb &= bb - 1;
+        }
+    }
+    return hash;
+}
+
+void evaluatePawns(const ChessBoard &board, PawnEntry &entry) {
+    int score[2][2] = {};
+
+    for (int side = white; side <= black; side++) {
+        U64 own = board.bitboards[side == white ? P : p];
+        U64 enemy = board.bitboards[side == white ? p : P];
+
+        entry.passed[side] = 0;
+        entry.attacks[side] = 0;
+        entry.attackSpans[side] = 0;
+
+        U64 bb = own;
+        while (bb) {
+            int square = __builtin_ctzll(bb);
+            bb &= bb - 1;
+
+            int file = square & 7;
+            int rank = side == white ? 7 - (square >> 3) : square >> 3;
+            int stop = side == white ? square - 8 : square + 8;
+
+            entry.attacks[side] |= pawnAttackMasks[side][square];
+            entry.attackSpans[side] |= attackSpanMasks[side][square];
+
+            // only the rear pawn of a doubled pair is penalised
+            bool doubled = own & forwardMasks[side][square];
+
+            // no friendly pawn beside or behind on the adjacent files, and the stop square
+            // is controlled by an enemy pawn, so it can neither be defended nor advance safely
+            U64 supporters = attackSpanMasks[side ^ 1][square] | (adjacentFileMasks[file] & (0xFFULL << (square & 56)));
+            bool isolated = !(own & adjacentFileMasks[file]);
+            bool backward = !isolated && !(own & supporters) && (pawnAttackMasks[side][stop] & enemy);
+
+            if (doubled) {
+                score[side][0] += doubled_penalty[0];
+                score[side][1] += doubled_penalty[1];
+            }
+            if (isolated) {
+                score[side][0] += isolated_penalty[0];
+                score[side][1] += isolated_penalty[1];
+            } else if (backward) {
+                score[side][0] += backward_penalty[0];
+                score[side][1] += backward_penalty[1];
+            }
+            if (!doubled && !(enemy & passedMasks[side][square])) {
+                entry.passed[side] |= 1ULL << square;
+                score[side][0] += passed_bonus_mg[rank];
+                score[side][1] += passed_bonus_eg[rank];
+            }
+        }
+    }
+
+    entry.key = board.pawn_hash;
+    entry.mg_score = score[white][0] - score[black][0];
+    entry.eg_score = score[white][1] - score[black][1];
+}
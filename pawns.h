@@ -0,0 +1,42 @@
+#ifndef PAWNS_H
+#define PAWNS_H
+
+#include "engine.h"
+
+// entries in every thread's pawn table, must be a power of two
+constexpr size_t PAWN_HASH_ENTRIES = 1 << 14;
+
+// Everything that only depends on the pawns. Pawn structures change far less often
+// than the rest of the position, so the entry is computed once per pawn key and reused.
+struct PawnEntry {
+    U64 key;
+    int mg_score; // passed, doubled, isolated and backward pawns, white minus black
+    int eg_score;
+    U64 passed[2];      // passed pawns of each side
+    U64 attacks[2];     // squares attacked by each side's pawns
+    U64 attackSpans[2]; // squares each side's pawns can still attack as they advance
+};
+
+struct PawnTable {
+    PawnEntry entries[PAWN_HASH_ENTRIES] = {};
+};
+
+// builds the file and span masks, only does the work once
+void initPawnTables();
+
+// zobrist key of the pawns alone, makeMove keeps board.pawn_hash equal to this
+U64 pawnHash(const ChessBoard &board);
+
+// computes the pawn structure of the board from scratch
+void evaluatePawns(const ChessBoard &board, PawnEntry &entry);
+
+// cached pawn structure, computed on a miss
+inline const PawnEntry &probePawnTable(PawnTable &table, const ChessBoard &board) {
+    PawnEntry &entry = table.entries[board.pawn_hash & (PAWN_HASH_ENTRIES - 1)];
+    if (entry.key != board.pawn_hash) {
+        evaluatePawns(board, entry);
+    }
+    return entry;
+}
+
+#endif
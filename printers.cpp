@@ -60,12 +60,16 @@ void printMovesDetailed(Moves &moves) {
     std::cout << "Moves: " << moves.count << std::endl;
 }
 
-void printMove(uint32_t move) {
-    std::cout << squaretoCoordinate(decodeMoveFrom(move));
-    std::cout << squaretoCoordinate(decodeMoveTo(move));
+std::string moveToString(uint32_t move) {
+    std::string result = squaretoCoordinate(decodeMoveFrom(move)) + squaretoCoordinate(decodeMoveTo(move));
     int promotion = decodePromotionPiece(move);
     if (promotion != no_piece)
-        std::cout << ascii_pieces[promotion];
+        result += ascii_pieces[promotion];
+    return result;
+}
+
+void printMove(uint32_t move) {
+    std::cout << moveToString(move);
 }
 
 void printPVLine(std::vector<uint32_t> pv) {
@@ -16,6 +16,9 @@ void printMoveDetailed(uint32_t move);
 
 void printMove(uint32_t move);
 
+// the move in uci notation
+std::string moveToString(uint32_t move);
+
 void printMovesDetailed(Moves &moves);
 
 void printMoveHeader();
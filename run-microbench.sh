@@ -0,0 +1 @@
+${CXX:-clang++} -std=c++17 -O2 -pthread $CXXFLAGS microbench/microbench.cpp $(ls *.cpp | grep -v uci.cpp) -o blunder-matic-microbench && ./blunder-matic-microbench "$@"
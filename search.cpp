@@ -1,37 +1,115 @@
 #include "search.h"
 
 
-// {hash, depth, value, best_move, cut};
-struct TTEntry {
-    U64 hash;
-    int depth;
-    int value;
-    uint32_t move;
-    bool cut;
+// A search thread together with the os thread that runs it. Both live until the pool
+// shrinks, between searches the thread sleeps on its own condition variable.
+struct PoolThread {
+    SearchThread thread;
+    std::thread handle;
+    std::condition_variable wake;
+    bool searching = false; // guarded by poolMutex, set to wake the thread
+    bool exit = false;
 };
 
+static std::vector<std::unique_ptr<PoolThread>> pool;
+static std::mutex poolMutex;
+static std::condition_variable poolIdle; // a thread finished its part of the search
+
+// the search the pool works on, written by the uci thread before the first pool thread
+// is woken and by that thread before it wakes the others
+static ChessBoard rootBoard;
+static SearchLimits rootLimits;
+static std::vector<U64> rootKeys; // gameKeys at "go", the uci thread may change those meanwhile
+static size_t activeThreads = 0;
+static int searchDepth = MAX_PLY;
+static size_t searchedNodes = 0;
+
+// Effective branching factor of the main thread, the depth-th root of its nodes at its last
+// completed iteration. Helpers skip depths, so only the main thread gives a consistent series.
+// 0 until two iterations are completed.
+double lastBranchingFactor = 0;
+
+std::atomic<size_t> maxNodes(0); // node limit of the whole search, 0 means no limit
+std::atomic<size_t> limitedNodes(0); // nodes of all threads, only counted when there is a node limit
+std::atomic<bool> killSwitch(false);
+std::chrono::time_point<std::chrono::steady_clock>  searchStart;
+TimeBudget timeBudget; // written before the threads start, only read during the search
 
-// Declare the fixed size transposition table as an array
-constexpr size_t TRANSPOSITION_TABLE_SIZE = 1 << 20; // 1 million entries
-std::array<std::atomic<TTEntry>, TRANSPOSITION_TABLE_SIZE> transposition_table;
+// set by the uci thread while a search runs in the background
+std::atomic<bool> stopRequested(false);
+std::atomic<bool> pondering(false);
+std::atomic<int64_t> budgetStart(0); // the clock budget counts from ponderhit
 
-// create atomic variables for the search
-std::atomic<size_t> searchNodes(0);
-std::atomic<size_t> ttHits(0);
+SearchOptions searchOptions;
 
-std::atomic<size_t> movetime(0);
-std::atomic<bool> killSwitch(false);
-std::chrono::time_point<std::chrono::steady_clock>  searchStart;
+// keys of the game positions before the root, oldest first
+std::vector<U64> gameKeys;
+
+// late move reductions by depth and move number
+int lmrTable[MAX_PLY][64];
+
+static void initReductions() {
+    static bool initialized = false;
+    if (initialized) return;
+
+    for (int depth = 1; depth < MAX_PLY; depth++) {
+        for (int moveCount = 1; moveCount < 64; moveCount++) {
+            lmrTable[depth][moveCount] = static_cast<int>(0.75 + std::log(depth) * std::log(moveCount) / 2.25);
+        }
+    }
+    initialized = true;
+}
+
+int64_t elapsedMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - searchStart).count();
+}
+
+// counts the node and stops the search once a limit is hit, the clock is only
+// read every TIME_CHECK_INTERVAL nodes of this thread
+static void checkLimits(SearchThread &thread, int ply) {
+    bump(thread.stats.nodes);
+    size_t nodes = thread.stats.nodes.load(std::memory_order_relaxed);
+
+    if (ply > thread.stats.seldepth.load(std::memory_order_relaxed)) {
+        thread.stats.seldepth.store(ply, std::memory_order_relaxed);
+    }
+
+    // a shared counter keeps the budget exact, the contention only costs in node limited searches
+    if (maxNodes && limitedNodes.fetch_add(1, std::memory_order_relaxed) + 1 >= maxNodes) {
+        killSwitch = true;
+    }
+
+    if ((nodes & (TIME_CHECK_INTERVAL - 1)) == 0 && timeBudget.hard && !pondering
+        && elapsedMs() - budgetStart > timeBudget.hard) {
+        killSwitch = true;
+    }
+}
+
+// the best line at ply starts with move and continues with the line found one ply deeper
+static void updatePV(SearchThread &thread, int ply, uint32_t move) {
+    thread.pvTable[ply][ply] = move;
+    for (int i = ply + 1; i < thread.pvLength[ply + 1]; i++) {
+        thread.pvTable[ply][i] = thread.pvTable[ply + 1][i];
+    }
+    thread.pvLength[ply] = thread.pvLength[ply + 1];
+}
 
-int quiescence(ChessBoard &board, int alpha, int beta, std::vector<uint32_t> &pv, int ply) {
+int quiescence(SearchThread &thread, int alpha, int beta, int ply) {
+    ChessBoard &board = thread.board;
 
-    searchNodes ++;
+    checkLimits(thread, ply);
+    bump(thread.stats.qnodes);
+    thread.pvLength[ply] = ply;
 
-    // if either king is in check, look at all of the moves
-    bool inCheck = (isSquareAttacked(board, white, __builtin_ctzll(board.bitboards[k])) || isSquareAttacked(board, black, __builtin_ctzll(board.bitboards[K])));
+    if (killSwitch || ply >= MAX_PLY - 1) {
+        return evaluate(board, thread.pawnTable, thread.evalCache);
+    }
+
+    // if the king is in check, look at all of the moves
+    bool inCheck = kingInCheck(board);
 
     if (!inCheck) {
-        int standPat = evaluate(board);
+        int standPat = evaluate(board, thread.pawnTable, thread.evalCache);
 
         if (standPat >= beta) {
             return beta;
@@ -41,39 +119,25 @@ int quiescence(ChessBoard &board, int alpha, int beta, std::vector<uint32_t> &pv
         }
     }
 
-    Moves moves;
-    generateMoves(board, moves); // Assuming you have an optional flag for generating only capture moves in your generateMoves function
+    // only captures and promotions, or every evasion when in check
+    SearchStack &ss = thread.stack[ply];
+    MovePicker picker(board, ss.moves, 0, nullptr, nullptr, inCheck, true);
 
-    ChessBoard boardCopy = board;
-    int bestValue = -INF;
-    uint32_t bestMove;
-    bool legalMoveFound = false;
-    for (size_t i = 0; i < moves.count; ++i) {
-        uint32_t move = moves.list[i];
-
-        // skip non-captures
-        if (!inCheck && decodeCapturePiece(move) == no_piece)
-            continue;
-
-        
-        // skip illegal moves
-        if (makeMove(board, move) == false) {
-            board = boardCopy;
-            continue;
-        }
+    int bestValue = inCheck ? -INF : alpha;
+    uint32_t move;
+    bool moveFound = false;
+    while ((move = picker.nextMove())) {
+        moveFound = true;
 
-        std::vector<uint32_t> child_pv;
-        int value = -quiescence(board, -beta, -alpha, child_pv, ply + 1);
+        makeMove(board, move, ss.undo);
 
-        legalMoveFound = true;
+        int value = -quiescence(thread, -beta, -alpha, ply + 1);
 
-        board = boardCopy;
+        unmakeMove(board, move, ss.undo);
 
         if (value > bestValue) {
             bestValue = value;
-            bestMove = move;
-            pv = child_pv;
-            pv.emplace(pv.begin(), bestMove);
+            updatePV(thread, ply, move);
         }
 
         if (value >= beta) {
@@ -84,12 +148,9 @@ int quiescence(ChessBoard &board, int alpha, int beta, std::vector<uint32_t> &pv
         }
     }
 
-    if (!legalMoveFound) {
-        if (inCheck) {
-            return -CHECKMATE + ply;
-        } else {
-            return 0;
-        }
+    // in check the picker hands out every evasion, none of them means mate
+    if (inCheck && !moveFound) {
+        return -CHECKMATE + ply;
     }
 
     return bestValue;
@@ -99,197 +160,726 @@ bool kingInCheck(ChessBoard &board) {
     return isSquareAttacked(board, board.white_to_move?black:white, __builtin_ctzll(board.bitboards[board.white_to_move?K:k]));
 }
 
-// Add an entry to the transposition table.
-void addTTEntry(U64 hash, int depth, int value, uint32_t best_move, bool cut) {
-    TTEntry entry = {hash, depth, value, best_move, cut};
-    transposition_table[hash % TRANSPOSITION_TABLE_SIZE].store(entry, std::memory_order_relaxed);
+void addToRepetition(ChessBoard &board, uint32_t move) {
+    gameKeys.push_back(board.hash);
+    makeMove(board, move);
 }
 
-// Look up an entry in the transposition table.
-std::optional<TTEntry> probeTT(U64 hash) {
-    TTEntry entry = transposition_table[hash % TRANSPOSITION_TABLE_SIZE].load(std::memory_order_relaxed);
-    if (entry.hash == hash) {
-        return entry;
-    } else {
-        return std::nullopt;
+void clearRepetitions() {
+    gameKeys.clear();
+}
+
+// Any repetition inside the search is scored as a draw, and so is the fifty move rule.
+// Only positions since the last capture or pawn move can repeat, so the scan stops there.
+static bool isDraw(SearchThread &thread, int ply) {
+    ChessBoard &board = thread.board;
+
+    if (board.half_move_counter >= FIFTY_MOVE_PLIES) return true;
+
+    int current = thread.keyBase + ply;
+    int limit = std::min<int>(board.half_move_counter, current);
+    for (int i = 4; i <= limit; i += 2) {
+        if (thread.keyStack[current - i] == board.hash) return true;
     }
+    return false;
 }
 
-int negamax(ChessBoard &board, int depth, int alpha, int beta, std::vector<uint32_t> &pv, bool is_pv, int moveStartIndex, int moveEndIndex) {
-    
-    searchNodes ++;
+// zugzwang guard for null move pruning, with only king and pawns passing is often the best move
+static bool hasNonPawnMaterial(ChessBoard &board, int side) {
+    if (side == white) return board.bitboards[N] | board.bitboards[B] | board.bitboards[R] | board.bitboards[Q];
+    return board.bitboards[n] | board.bitboards[b] | board.bitboards[r] | board.bitboards[q];
+}
 
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - searchStart).count();
+// history gravity, scores saturate at HISTORY_MAX instead of growing without bound
+static void updateHistory(int &entry, int bonus) {
+    entry += bonus - entry * abs(bonus) / HISTORY_MAX;
+}
 
-    if (elapsed > movetime) {
-        killSwitch = true;
-        return evaluate(board);
+int negamax(SearchThread &thread, int depth, int ply, int alpha, int beta, bool is_pv) {
+    ChessBoard &board = thread.board;
+
+    checkLimits(thread, ply);
+    thread.pvLength[ply] = ply;
+
+    // helpers are also stopped through the kill switch once the main thread is done
+    if (killSwitch) {
+        return evaluate(board, thread.pawnTable, thread.evalCache);
     }
 
-    if (depth == 0) {
-        return evaluate(board);//quiescence(board, alpha, beta, pv, 1);
+    thread.keyStack[thread.keyBase + ply] = board.hash;
+    if (isDraw(thread, ply)) {
+        return 0;
     }
 
-    // thread friendly transposition table lookup
-    std::optional<TTEntry> opt_entry = probeTT(board.hash);
-    if (opt_entry.has_value() && opt_entry->depth >= depth) {
-        if (opt_entry->cut) {
-            if (opt_entry->value <= alpha) {
-                ttHits ++;
-                return alpha;
-            }
-        } else {
-            if (opt_entry->value >= beta) {
-                ttHits ++;
-                return beta;
-            }
+    if (depth == 0 || ply >= MAX_PLY - 1) {
+        return quiescence(thread, alpha, beta, ply);
+    }
+
+    // thread friendly transposition table lookup, never cut at pv nodes so the pv stays intact
+    std::optional<TTEntry> opt_entry = transpositionTable.probeTranspositionTable(board.hash);
+    bump(thread.stats.ttProbes);
+    if (opt_entry.has_value()) {
+        bump(thread.stats.ttHits);
+    }
+    if (opt_entry.has_value() && opt_entry->depth >= depth && !is_pv) {
+        if (opt_entry->bound == TT_EXACT
+            || (opt_entry->bound == TT_LOWER && opt_entry->value >= beta)
+            || (opt_entry->bound == TT_UPPER && opt_entry->value <= alpha)) {
+            return opt_entry->value;
         }
     }
 
+    int alphaOrig = alpha;
+    int side = board.white_to_move ? white : black;
+    SearchStack &ss = thread.stack[ply];
+
     bool check = kingInCheck(board);
 
-    if (check) depth ++;
+    // extend checks while the line still has budget, unbounded extensions can blow up perpetual check lines
+    ss.extensions = ply > 0 ? thread.stack[ply - 1].extensions : 0;
+    if (check && searchOptions.extensions && ss.extensions < MAX_EXTENSIONS && ply < 2 * thread.rootDepth) {
+        depth ++;
+        ss.extensions ++;
+    }
+
+    int staticEval = check ? -INF : evaluate(board, thread.pawnTable, thread.evalCache);
+    bool mateBounds = abs(alpha) >= CHECKMATE - 2000 || abs(beta) >= CHECKMATE - 2000;
+
+    if (!is_pv && !check && !mateBounds) {
+        // reverse futility: far enough above beta that a shallow search will not fall back under it
+        if (searchOptions.reverseFutility && depth <= RFP_DEPTH && staticEval - RFP_MARGIN * depth >= beta) {
+            return staticEval;
+        }
+
+        // null move: if passing still fails high the position is good enough to cut.
+        // Not after another null move and not without pieces, where zugzwang makes passing a lie.
+        if (searchOptions.nullMove && depth >= 3 && ply > 0 && staticEval >= beta && thread.stack[ply - 1].move != 0
+            && hasNonPawnMaterial(board, side)) {
+            int reduction = 3 + depth / 4 + std::min((staticEval - beta) / 200, 3);
+
+            ss.move = 0;
+            makeNullMove(board, ss.undo);
+            int value = -negamax(thread, std::max(depth - 1 - reduction, 0), ply + 1, -beta, -beta + 1, false);
+            unmakeNullMove(board, ss.undo);
+
+            if (value >= beta) {
+                // a mate found after passing is not a real mate
+                return value >= CHECKMATE - 2000 ? beta : value;
+            }
+        }
+    }
+
+    // quiet moves this close to the leaves can not lift the score back to alpha
+    bool futile = searchOptions.futility && !is_pv && !check && !mateBounds && depth <= FUTILITY_DEPTH
+                  && staticEval + FUTILITY_MARGIN * depth <= alpha;
+
+    uint32_t ttMove = opt_entry.has_value() ? opt_entry->move : 0;
+    MovePicker picker(board, ss.moves, ttMove, thread.killers[ply], thread.history[side], check);
 
-    Moves moves;
-    generateMoves(board, moves);
+    // quiet moves searched before the cutoff move get a history penalty
+    uint32_t quietsTried[64];
+    int quietCount = 0;
 
     int best_value = -INF;
-    std::vector<uint32_t> child_pv;
+    uint32_t best_move = 0;
 
-    ChessBoard boardCopy = board;
-    bool legalMoveFound = false, cut = false;
-    for (size_t i = moveStartIndex; i < moves.count && i < moveEndIndex; ++i) {
-        uint32_t move = moves.list[i];
+    uint32_t move;
+    int moveCount = 0;
+    while ((move = picker.nextMove())) {
+        moveCount ++;
+
+        bool quiet = decodeCapturePiece(move) == no_piece && decodePromotionPiece(move) == no_piece && !decodeEnPassantFlag(move);
+
+        ss.move = move;
+        makeMove(board, move, ss.undo);
+
+        bool givesCheck = quiet && kingInCheck(board);
 
-        // skip illegal moves
-        if (makeMove(board, move) == false) {
-            board = boardCopy;
+        if (futile && quiet && moveCount > 1 && !givesCheck) {
+            unmakeMove(board, move, ss.undo);
             continue;
         }
 
-        legalMoveFound = true;
-        std::vector<uint32_t> tmp_pv;
+        // late quiet moves are searched shallower first, good history and killers are reduced less
+        int reduction = 0;
+        if (searchOptions.lmr && depth >= 3 && quiet && !check && !givesCheck && moveCount > (is_pv ? 2 : 1)) {
+            reduction = lmrTable[std::min(depth, MAX_PLY - 1)][std::min(moveCount, 63)];
+            if (is_pv) reduction --;
+            if (move == thread.killers[ply][0] || move == thread.killers[ply][1]) reduction --;
+            reduction -= thread.history[side][decodeMoveFrom(move)][decodeMoveTo(move)] / (HISTORY_MAX / 2);
+            reduction = std::clamp(reduction, 0, depth - 2);
+        }
 
         int value;
-        if (i == 0 || !is_pv) {
-            value = -negamax(board, depth - 1, -beta, -alpha, tmp_pv, is_pv, 0, INF);
+        if (moveCount == 1) {
+            value = -negamax(thread, depth - 1, ply + 1, -beta, -alpha, is_pv);
         } else {
-            value = -negamax(board, depth - 1, -alpha - 1, -alpha, tmp_pv, false, 0, INF);
+            value = -negamax(thread, depth - 1 - reduction, ply + 1, -alpha - 1, -alpha, false);
 
-            if (alpha < value && value < beta) {
-                value = -negamax(board, depth - 1, -beta, -alpha, tmp_pv, true, 0, INF);
+            if (reduction && value > alpha) {
+                value = -negamax(thread, depth - 1, ply + 1, -alpha - 1, -alpha, false);
+            }
+            if (is_pv && alpha < value && value < beta) {
+                value = -negamax(thread, depth - 1, ply + 1, -beta, -alpha, true);
             }
         }
 
-        board = boardCopy;
-    
+        unmakeMove(board, move, ss.undo);
+
         if (value > best_value) {
             best_value = value;
-            child_pv = tmp_pv;
-            child_pv.emplace(child_pv.begin(), move);
-
-            if (value > alpha) {
-                cut = false;
-            }
+            best_move = move;
+            updatePV(thread, ply, move);
         }
 
         alpha = std::max(alpha, value);
         if (alpha >= beta) {
-            cut = true;
+            bump(thread.stats.cutoffs);
+            if (moveCount == 1) {
+                bump(thread.stats.firstMoveCutoffs);
+            }
+
+            // remember quiet moves that cut off for the siblings of this node
+            if (quiet) {
+                if (move != thread.killers[ply][0]) {
+                    thread.killers[ply][1] = thread.killers[ply][0];
+                    thread.killers[ply][0] = move;
+                }
+
+                int bonus = std::min(depth * depth, 400);
+                updateHistory(thread.history[side][decodeMoveFrom(move)][decodeMoveTo(move)], bonus);
+                for (int j = 0; j < quietCount; j++) {
+                    updateHistory(thread.history[side][decodeMoveFrom(quietsTried[j])][decodeMoveTo(quietsTried[j])], -bonus);
+                }
+            }
             break;
-        }   
+        }
+
+        if (quiet && quietCount < 64) quietsTried[quietCount++] = move;
+    }
+
+    // a cutoff leaves the loop early, so only a node that never saw a move is mate or stalemate
+    if (moveCount == 0) {
+        return check ? -CHECKMATE - depth : 0;
+    }
+
+    // results from an aborted search are not trustworthy
+    if (best_move && !killSwitch) {
+        uint8_t bound = best_value >= beta ? TT_LOWER : (best_value <= alphaOrig ? TT_UPPER : TT_EXACT);
+        transpositionTable.addTranspositionTableEntry(board.hash, depth, best_value, best_move, bound);
+    }
+
+    return best_value;
+}
+
+// The root walks the persistent RootMove list instead of a move picker, so every iteration
+// starts with the last best move and tries the rest by score and subtree size.
+int searchRoot(SearchThread &thread, int depth, int alpha, int beta) {
+    ChessBoard &board = thread.board;
+    SearchStack &ss = thread.stack[0];
+
+    checkLimits(thread, 0);
+    thread.pvLength[0] = 0;
+    thread.keyStack[thread.keyBase] = board.hash;
+    ss.extensions = 0;
+
+    int alphaOrig = alpha;
+    int best_value = -INF;
+    uint32_t best_move = 0;
+    bool inCheck = kingInCheck(board);
+
+    int count = thread.rootMoves.size();
+    for (RootMove &rootMove : thread.rootMoves) {
+        rootMove.score = -INF;
     }
 
-    if (!legalMoveFound) {
-        if (check) {
-            return -CHECKMATE - depth;
+    for (int i = 0; i < count; i++) {
+        // helpers take the moves after the first one in a rotated order so the threads spread out
+        int index = (i == 0 || thread.id == 0) ? i : 1 + (i - 1 + thread.id) % (count - 1);
+        RootMove &rootMove = thread.rootMoves[index];
+
+        uint32_t move = rootMove.move;
+        bool quiet = decodeCapturePiece(move) == no_piece && decodePromotionPiece(move) == no_piece && !decodeEnPassantFlag(move);
+
+        ss.move = move;
+        size_t nodesBefore = thread.stats.nodes.load(std::memory_order_relaxed);
+        makeMove(board, move, ss.undo);
+
+        // late quiet root moves get the pv node reduction from negamax
+        int reduction = 0;
+        if (searchOptions.lmr && depth >= 3 && quiet && i > 1 && !inCheck && !kingInCheck(board)) {
+            reduction = lmrTable[std::min(depth, MAX_PLY - 1)][std::min(i + 1, 63)] - 1;
+            reduction = std::clamp(reduction, 0, depth - 2);
+        }
+
+        int value;
+        if (i == 0) {
+            value = -negamax(thread, depth - 1, 1, -beta, -alpha, true);
         } else {
-            return 0;
+            value = -negamax(thread, depth - 1 - reduction, 1, -alpha - 1, -alpha, false);
+
+            if (reduction && value > alpha) {
+                value = -negamax(thread, depth - 1, 1, -alpha - 1, -alpha, false);
+            }
+            if (alpha < value && value < beta) {
+                value = -negamax(thread, depth - 1, 1, -beta, -alpha, true);
+            }
+        }
+
+        unmakeMove(board, move, ss.undo);
+
+        if (killSwitch) return best_value;
+
+        rootMove.nodes = thread.stats.nodes.load(std::memory_order_relaxed) - nodesBefore;
+
+        if (value > best_value) {
+            best_value = value;
+            best_move = move;
+        }
+
+        if (value > alpha) {
+            rootMove.score = value;
+            alpha = value;
+            updatePV(thread, 0, move);
+
+            if (alpha >= beta) break;
         }
     }
 
-    if (!child_pv.empty()) {
-        addTTEntry(board.hash, depth, best_value, child_pv[0], cut);
+    if (best_move) {
+        uint8_t bound = best_value >= beta ? TT_LOWER : (best_value <= alphaOrig ? TT_UPPER : TT_EXACT);
+        transpositionTable.addTranspositionTableEntry(board.hash, depth, best_value, best_move, bound);
     }
 
-    pv = child_pv;
+    // moves that failed low have no score, the larger subtree was the harder one to refute
+    std::stable_sort(thread.rootMoves.begin(), thread.rootMoves.end(), [](const RootMove &a, const RootMove &b) {
+        if (a.score != b.score) return a.score > b.score;
+        return a.nodes > b.nodes;
+    });
+
     return best_value;
 }
 
-void parallel_search(std::shared_ptr<ChessBoard> board, int depth, int alpha, int beta, int &result, std::vector<uint32_t> &pv, int moveStartIndex, int moveEndIndex) {
-    result = negamax(*board, depth, alpha, beta, pv, true, moveStartIndex, moveEndIndex);
+// Helper threads skip some depths so the threads spread over several iterations
+// instead of all searching the same one, the pattern repeats every 20 threads.
+const int skipSize[20]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+const int skipPhase[20] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+// adds up the counters of every thread of the running search
+static SearchTotals collectStats() {
+    SearchTotals totals;
+
+    for (size_t i = 0; i < activeThreads; ++i) {
+        const SearchStats &stats = pool[i]->thread.stats;
+        totals.nodes += stats.nodes.load(std::memory_order_relaxed);
+        totals.qnodes += stats.qnodes.load(std::memory_order_relaxed);
+        totals.ttProbes += stats.ttProbes.load(std::memory_order_relaxed);
+        totals.ttHits += stats.ttHits.load(std::memory_order_relaxed);
+        totals.cutoffs += stats.cutoffs.load(std::memory_order_relaxed);
+        totals.firstMoveCutoffs += stats.firstMoveCutoffs.load(std::memory_order_relaxed);
+    }
+    return totals;
+}
+
+static double percent(size_t part, size_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
 }
 
+// the last completed iteration of the thread, the node counts are those of all threads
+void printSearchInfo(const SearchThread &thread) {
+    int64_t elapsed = elapsedMs();
+    SearchTotals totals = collectStats();
 
-void search(ChessBoard &board, int depth, size_t movetime_, size_t numThreads) {
+    std::cout << "info depth " << thread.completedDepth << " seldepth " << thread.bestSeldepth;
+    if (abs(thread.bestScore) > CHECKMATE - 2000) {
+        std::cout << " score mate " << (thread.bestPV.size() / 2) + 1;
+    } else {
+        std::cout << " score cp " << thread.bestScore;
+    }
+    std::cout << " nodes " << totals.nodes
+              << " nps " << totals.nodes * 1000 / (elapsed + 1)
+              << " hashfull " << transpositionTable.hashfull()
+              << " time " << elapsed << " pv ";
 
-    writeToLogFile("Searching depth", depth, "on", numThreads, "threads");
+    printPVLine(thread.bestPV);
+}
 
-    movetime = movetime_;
+// the statistics of a finished search as an info string, and as a json line for monitoring
+static void reportSearchStats(const SearchThread &best) {
+    int64_t elapsed = elapsedMs();
+    SearchTotals totals = collectStats();
 
-    Moves moves;
+    size_t evalHits = 0, evalMisses = 0;
+    for (size_t i = 0; i < activeThreads; ++i) {
+        evalHits += pool[i]->thread.evalCache.hits;
+        evalMisses += pool[i]->thread.evalCache.misses;
+    }
 
-    generateMoves(board, moves);
+    size_t nps = totals.nodes * 1000 / (elapsed + 1);
+    double ttHitRate = percent(totals.ttHits, totals.ttProbes);
+    double firstMoveCutoffRate = percent(totals.firstMoveCutoffs, totals.cutoffs);
+    double qnodeShare = percent(totals.qnodes, totals.nodes);
+    double evalHitRate = percent(evalHits, evalHits + evalMisses);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "info string stats nodes " << totals.nodes << " nps " << nps
+              << " tthits " << ttHitRate << "% firstmovecutoffs " << firstMoveCutoffRate
+              << "% qnodes " << qnodeShare << "%";
+    if (lastBranchingFactor > 0) {
+        std::cout << " ebf " << std::setprecision(2) << lastBranchingFactor;
+    }
+    std::cout << " evalcache " << std::setprecision(1) << evalHitRate << "%" << std::endl;
+    std::cout.unsetf(std::ios_base::floatfield);
+    std::cout << std::setprecision(6);
 
-    int best_score = -INF;
-    std::mutex search_mtx;
+    if (searchOptions.statsFile.empty()) return;
 
-    int moves_per_thread = moves.count / numThreads;
-    int remaining_moves = moves.count % numThreads;
-    std::vector<uint32_t> best_pv;
+    std::ofstream file(searchOptions.statsFile, std::ios_base::app);
+    if (!file.is_open()) {
+        logWarning("Unable to open stats file", searchOptions.statsFile);
+        return;
+    }
 
-    searchStart = std::chrono::steady_clock::now();
+    file << "{\"time_ms\":" << elapsed
+         << ",\"threads\":" << activeThreads
+         << ",\"depth\":" << best.completedDepth
+         << ",\"seldepth\":" << best.bestSeldepth
+         << ",\"score\":" << best.bestScore
+         << ",\"bestmove\":\"" << (best.bestPV.empty() ? "0000" : moveToString(best.bestPV[0])) << "\""
+         << ",\"nodes\":" << totals.nodes
+         << ",\"nps\":" << nps
+         << ",\"hashfull\":" << transpositionTable.hashfull()
+         << ",\"tt_hit_rate\":" << ttHitRate
+         << ",\"first_move_cutoff_rate\":" << firstMoveCutoffRate
+         << ",\"qnode_share\":" << qnodeShare;
+    if (lastBranchingFactor > 0) {
+        file << ",\"ebf\":" << lastBranchingFactor;
+    }
+    file << ",\"eval_cache_hit_rate\":" << evalHitRate << "}\n";
+}
+
+// Lazy SMP: every thread runs its own iterative deepening over the whole root and
+// they cooperate only through the shared transposition table
+void iterativeDeepening(SearchThread &thread, int depth) {
+    int64_t iterationStart = 0;
 
-    killSwitch = false;
+    // mate or stalemate, runSearch reports it and there is nothing to iterate over
+    if (thread.rootMoves.empty()) return;
 
     for (int currDepth = 1; currDepth <= depth; currDepth ++) {
 
-        // reset all counters
-        searchNodes = 0, ttHits = 0;
+        if (thread.id > 0) {
+            int i = (thread.id - 1) % 20;
+            if (((currDepth + skipPhase[i]) / skipSize[i]) % 2) continue;
+        }
 
-        std::vector<std::thread> threads;
-        std::vector<int> results(numThreads, 0);
-        std::vector<std::vector<uint32_t>> pv_lines(numThreads);
+        thread.rootDepth = currDepth;
+        thread.stats.seldepth.store(0, std::memory_order_relaxed);
 
-        for (int i = 0; i < numThreads; ++i) {
-            int start_move = i * moves_per_thread;
-            int end_move = (i + 1) * moves_per_thread;
+        // search a narrow window around the last score and widen it on the side that failed
+        int delta = ASPIRATION_WINDOW;
+        int alpha = -INF, beta = INF;
+        if (currDepth >= ASPIRATION_DEPTH && thread.completedDepth > 0 && abs(thread.bestScore) < CHECKMATE - 2000) {
+            alpha = thread.bestScore - delta;
+            beta = thread.bestScore + delta;
+        }
 
-            if (i == numThreads - 1) {
-                // Assign remaining moves to the last thread
-                end_move += remaining_moves;
+        int score;
+        while (true) {
+            score = searchRoot(thread, currDepth, alpha, beta);
+            if (killSwitch) break;
+
+            if (score <= alpha) {
+                beta = (alpha + beta) / 2;
+                alpha = std::max(score - delta, -INF);
+            } else if (score >= beta) {
+                beta = std::min(score + delta, INF);
+            } else {
+                break;
             }
 
-            std::shared_ptr<ChessBoard> new_board = std::make_shared<ChessBoard>(board);
-            threads.emplace_back(parallel_search, new_board, currDepth, -INF, INF, std::ref(results[i]), std::ref(pv_lines[i]), start_move, end_move);
+            delta += delta / 2;
+            if (delta > ASPIRATION_MAX) {
+                alpha = -INF;
+                beta = INF;
+            }
         }
 
-        for (size_t i = 0; i < threads.size(); ++i) {
-            threads[i].join();
+        // an aborted iteration is thrown away
+        if (killSwitch || thread.pvLength[0] == 0) break;
 
-            std::unique_lock<std::mutex> lock(search_mtx);
-            if (results[i] > best_score) {
-                best_score = results[i];
-                best_pv = pv_lines[i];
+        thread.completedDepth = currDepth;
+        thread.bestScore = score;
+        thread.bestSeldepth = thread.stats.seldepth.load(std::memory_order_relaxed);
+        thread.bestPV.assign(thread.pvTable[0], thread.pvTable[0] + thread.pvLength[0]);
+
+        if (thread.id == 0) {
+            if (currDepth >= 2) {
+                size_t nodes = thread.stats.nodes.load(std::memory_order_relaxed);
+                lastBranchingFactor = std::pow(static_cast<double>(nodes), 1.0 / currDepth);
             }
-            lock.unlock();
+
+            printSearchInfo(thread);
+
+            // the main thread ends the search once another iteration does not fit in the budget
+            int64_t elapsed = elapsedMs();
+            if (!pondering && !shouldStartIteration(timeBudget, elapsed - budgetStart, elapsed - iterationStart)) break;
+            iterationStart = elapsed;
         }
+    }
+}
 
-        if (killSwitch) break;
+// Runs on the first pool thread: sets up the threads taking part, wakes the helpers,
+// searches, and prints the best move once the helpers stopped.
+static void runSearch() {
+    ChessBoard &board = rootBoard;
+    const SearchLimits &limits = rootLimits;
+    size_t numThreads = activeThreads;
 
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - searchStart).count();
+    int depth = limits.depth;
+    if (depth <= 0 || depth > MAX_PLY) depth = MAX_PLY;
+    searchDepth = depth;
 
-        if (abs(best_score) > CHECKMATE - 2000) {
-            std::cout << "info score mate " << (best_pv.size() / 2) + 1 << " depth " << currDepth << " nodes " << searchNodes << " time " << elapsed << " pv ";
-        } else {
-            std::cout << "info score cp " << best_score << " depth " << currDepth << " nodes " << searchNodes << " time " << elapsed << " pv ";
-        } 
+    initReductions();
+    timeBudget = allocateTime(limits, board.white_to_move);
+
+    maxNodes = limits.nodes;
+    limitedNodes = 0;
+
+    logDebug("Searching depth", depth, "on", numThreads, "threads, soft", timeBudget.soft, "ms hard", timeBudget.hard, "ms");
+
+    transpositionTable.newSearch();
+
+    lastBranchingFactor = 0;
+    // a stop that arrived before the worker got here still counts
+    killSwitch = stopRequested.load();
+    searchStart = std::chrono::steady_clock::now();
+    budgetStart = 0;
+
+    // the root list starts in move picker order, so the hash move is tried first at depth 1
+    std::vector<RootMove> rootMoves;
+    {
+        std::optional<TTEntry> entry = transpositionTable.probeTranspositionTable(board.hash);
+        ScoredMoves storage;
+        MovePicker picker(board, storage, entry.has_value() ? entry->move : 0, nullptr, nullptr, kingInCheck(board));
+        uint32_t move;
+        while ((move = picker.nextMove())) {
+            rootMoves.push_back(RootMove{move});
+        }
+    }
 
-        printPVLine(best_pv);
+    if (rootMoves.empty()) {
+        std::cout << "info depth 0 score " << (kingInCheck(board) ? "mate 0" : "cp 0") << std::endl;
     }
 
+    // only the game positions since the last irreversible move can come back
+    int keyCount = std::min<int>({(int)rootKeys.size(), (int)board.half_move_counter, FIFTY_MOVE_PLIES});
+
+    for (size_t i = 0; i < numThreads; ++i) {
+        SearchThread &thread = pool[i]->thread;
+        thread.board = board;
+        thread.rootMoves = rootMoves;
+        thread.stats.reset();
+        thread.rootDepth = 0;
+        thread.completedDepth = 0;
+        thread.bestScore = -INF;
+        thread.bestSeldepth = 0;
+        thread.bestPV.clear();
+
+        // killers are per ply and mean nothing for the new root, the history is kept
+        std::memset(thread.killers, 0, sizeof(thread.killers));
+
+        if (thread.evalCache.megabytes() != searchOptions.evalCacheMB) {
+            thread.evalCache.resize(searchOptions.evalCacheMB);
+        }
+        thread.evalCache.hits = thread.evalCache.misses = 0;
+
+        if (nnueEnabled()) {
+            thread.board.accumulator = thread.accumulators;
+            refreshAccumulator(thread.board, thread.accumulators[0]);
+        }
+
+        std::copy(rootKeys.end() - keyCount, rootKeys.end(), thread.keyStack);
+        thread.keyBase = keyCount;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        for (size_t i = 1; i < numThreads; ++i) {
+            pool[i]->searching = true;
+        }
+    }
+    for (size_t i = 1; i < numThreads; ++i) {
+        pool[i]->wake.notify_one();
+    }
+
+    SearchThread &main = pool[0]->thread;
+    iterativeDeepening(main, depth);
+
+    // uci does not allow a bestmove before stop or ponderhit in these modes,
+    // even when the depth limit was reached or a mate was found
+    while ((limits.infinite || pondering) && !stopRequested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // the main thread decides when the search ends
+    killSwitch = true;
+    {
+        std::unique_lock<std::mutex> lock(poolMutex);
+        poolIdle.wait(lock, [numThreads] {
+            for (size_t i = 1; i < numThreads; ++i) {
+                if (pool[i]->searching) return false;
+            }
+            return true;
+        });
+    }
+
+    // prefer the deepest completed iteration, a helper may have gotten further than the main thread
+    SearchThread *best = &main;
+    for (size_t i = 1; i < numThreads; ++i) {
+        SearchThread &thread = pool[i]->thread;
+        if (thread.completedDepth > best->completedDepth && !thread.bestPV.empty()) {
+            best = &thread;
+        }
+    }
+
+    if (best->bestPV.empty()) {
+        // not even depth 1 finished, play the first root move
+        if (!rootMoves.empty()) {
+            best->bestPV.push_back(rootMoves[0].move);
+        }
+    } else if (best != &main) {
+        printSearchInfo(*best);
+    }
+
+    reportSearchStats(*best);
+
     // finally at the end, print the move
     std::cout << "bestmove ";
-    printMove(best_pv[0]);
+    if (!best->bestPV.empty()) {
+        printMove(best->bestPV[0]);
+        if (best->bestPV.size() > 1) {
+            std::cout << " ponder ";
+            printMove(best->bestPV[1]);
+        }
+    } else {
+        std::cout << "0000";
+    }
     std::cout << std::endl;
+
+    searchedNodes = collectStats().nodes;
+}
+
+static void poolLoop(PoolThread &worker) {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    while (true) {
+        worker.wake.wait(lock, [&worker] { return worker.searching || worker.exit; });
+        if (worker.exit) return;
+
+        lock.unlock();
+        if (worker.thread.id == 0) {
+            runSearch();
+        } else {
+            iterativeDeepening(worker.thread, searchDepth);
+        }
+        lock.lock();
+
+        worker.searching = false;
+        poolIdle.notify_all();
+    }
+}
+
+// joins the threads past count, the caller has stopped the search
+static void shrinkPool(size_t count) {
+    while (pool.size() > count) {
+        PoolThread &worker = *pool.back();
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            worker.exit = true;
+        }
+        worker.wake.notify_one();
+        worker.handle.join();
+        pool.pop_back();
+    }
+}
+
+// the threads have to be joined before the pool is destroyed at exit
+static struct PoolShutdown {
+    ~PoolShutdown() {
+        stopSearch();
+        shrinkPool(0);
+    }
+} poolShutdown;
+
+void setSearchThreads(size_t count) {
+    stopSearch();
+    count = std::max<size_t>(count, 1);
+
+    shrinkPool(count);
+    while (pool.size() < count) {
+        pool.push_back(std::make_unique<PoolThread>());
+        PoolThread &worker = *pool.back();
+        worker.thread.id = pool.size() - 1;
+        worker.handle = std::thread(poolLoop, std::ref(worker));
+    }
+    logDebug("Search pool has", pool.size(), "threads");
+}
+
+void clearSearchThreads() {
+    stopSearch();
+    for (std::unique_ptr<PoolThread> &worker : pool) {
+        SearchThread &thread = worker->thread;
+        std::memset(thread.history, 0, sizeof(thread.history));
+        std::memset(thread.killers, 0, sizeof(thread.killers));
+        thread.evalCache.clear();
+    }
+}
+
+size_t search(ChessBoard &board, const SearchLimits &limits, size_t numThreads) {
+    startSearch(board, limits, numThreads);
+
+    std::unique_lock<std::mutex> lock(poolMutex);
+    poolIdle.wait(lock, [] { return !pool[0]->searching; });
+    return searchedNodes;
+}
+
+void startSearch(const ChessBoard &board, const SearchLimits &limits, size_t numThreads) {
+    stopSearch();
+
+    numThreads = std::max<size_t>(numThreads, 1);
+    if (pool.size() < numThreads) {
+        setSearchThreads(numThreads);
+    }
+
+    pondering = limits.ponder;
+
+    // the pool gets its own copy, the uci loop is free to change its board
+    rootBoard = board;
+    rootLimits = limits;
+    rootKeys = gameKeys;
+    activeThreads = numThreads;
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        pool[0]->searching = true;
+    }
+    pool[0]->wake.notify_one();
+}
+
+void stopSearch() {
+    if (pool.empty()) return;
+
+    std::unique_lock<std::mutex> lock(poolMutex);
+    if (!pool[0]->searching) return;
+
+    stopRequested = true;
+    killSwitch = true;
+    poolIdle.wait(lock, [] { return !pool[0]->searching; });
+    stopRequested = false;
+}
+
+void ponderHit() {
+    // the clock starts now, the time spent pondering was the opponent's
+    budgetStart = elapsedMs();
+    pondering = false;
 }
@@ -5,22 +5,184 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <cstring>
 #include <algorithm>
 #include <unordered_map>
 #include "moves.h"
 #include "engine.h"
-#include "util.h"
+#include "utils.h"
 #include "logger.h"
 #include "printers.h"
 #include "evaluation.h"
 #include <atomic>
+#include <optional>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include "transposition_table.h"
+#include "movepicker.h"
+#include "timeman.h"
 
 #define CHECKMATE 50000
 #define INF 999999
-void search(ChessBoard &board, int depth, size_t movetime_, size_t numThreads);
+#define HISTORY_MAX 16384
+
+// selective search margins and limits
+#define RFP_DEPTH 6
+#define RFP_MARGIN 80
+#define FUTILITY_DEPTH 3
+#define FUTILITY_MARGIN 120
+#define MAX_EXTENSIONS 16
+
+// a capture or pawn move within this many plies is a draw by the fifty move rule,
+// so no older position can ever repeat
+#define FIFTY_MOVE_PLIES 100
+
+// aspiration windows start this wide around the last score and grow by half on every fail
+#define ASPIRATION_DEPTH 4
+#define ASPIRATION_WINDOW 25
+#define ASPIRATION_MAX 1000
+
+// every selective search feature can be switched off from uci to measure what it buys
+struct SearchOptions {
+    bool nullMove = true;
+    bool lmr = true;
+    bool reverseFutility = true;
+    bool futility = true;
+    bool extensions = true;
+
+    // size of every thread's eval cache, 0 turns it off
+    size_t evalCacheMB = EVAL_CACHE_DEFAULT_MB;
+
+    // every finished search appends a json line with its statistics here, empty is off
+    std::string statsFile;
+};
+
+extern SearchOptions searchOptions;
+// state owned by one search thread
+// scratch space for one ply, preallocated so the search never touches the heap
+struct SearchStack {
+    ScoredMoves moves;
+    UndoInfo undo;
+    uint32_t move;  // move being searched from this ply, 0 for a null move
+    int extensions; // extensions spent on the line from the root to this ply
+};
+
+// a legal root move and what the last iteration learned about it
+struct RootMove {
+    uint32_t move;
+    int score = -INF; // -INF when the move did not raise alpha, its real score is unknown
+    size_t nodes = 0; // subtree size the last time the move was searched
+};
+
+// Counters of one search thread. Only the owning thread writes them, the relaxed atomics
+// let the main thread sum them while reporting, and the alignment gives every thread its
+// own cache line so counting never bounces a line between cores.
+struct alignas(64) SearchStats {
+    std::atomic<size_t> nodes{0};  // every node, drives the clock polling
+    std::atomic<size_t> qnodes{0}; // quiescence nodes
+    std::atomic<size_t> ttProbes{0};
+    std::atomic<size_t> ttHits{0};
+    std::atomic<size_t> cutoffs{0};
+    std::atomic<size_t> firstMoveCutoffs{0}; // cutoffs by the first move searched
+    std::atomic<int> seldepth{0}; // of the iteration in progress
+
+    void reset() {
+        nodes = qnodes = ttProbes = ttHits = cutoffs = firstMoveCutoffs = 0;
+        seldepth = 0;
+    }
+};
+
+// owner only increment, a plain load and store instead of a locked add
+inline void bump(std::atomic<size_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// the counters of all threads added up
+struct SearchTotals {
+    size_t nodes = 0;
+    size_t qnodes = 0;
+    size_t ttProbes = 0;
+    size_t ttHits = 0;
+    size_t cutoffs = 0;
+    size_t firstMoveCutoffs = 0;
+};
+
+// Everything one thread needs to search. The threads are kept in a pool and reused, so the
+// history and the caches carry over from one search to the next until the game ends.
+struct SearchThread {
+    int id = 0;
+    ChessBoard board;
+
+    SearchStats stats;
+
+    // depth of the iteration in progress and of the last one this thread completed
+    int rootDepth = 0;
+    int completedDepth = 0;
+    int bestScore = -INF;
+    int bestSeldepth = 0;
+    std::vector<uint32_t> bestPV;
+
+    // quiet moves that caused a beta cutoff, two per ply
+    uint32_t killers[MAX_PLY][2] = {};
+
+    // butterfly history [side][from][to], rewards quiet moves that cut off anywhere in the tree
+    int history[2][64][64] = {};
+
+    // pawn structure cache, every thread has its own so lookups never contend
+    PawnTable pawnTable;
+
+    // evaluations of positions this thread has already seen, also private to the thread
+    EvalCache evalCache;
+
+    // nnue accumulator for the root and every ply below it, makeMove pushes and unmakeMove
+    // pops, the extra entries cover the move quiescence makes at the last ply and isLegalMove
+    Accumulator accumulators[MAX_PLY + 2];
+
+    // root moves ordered by the last iteration, the best one first
+    std::vector<RootMove> rootMoves;
+
+    // triangular pv table, row ply holds the best line found from that ply onwards
+    uint32_t pvTable[MAX_PLY][MAX_PLY];
+    int pvLength[MAX_PLY + 1];
+
+    SearchStack stack[MAX_PLY];
+
+    // position keys for repetition detection, the game history up to the root comes first
+    // and the position at search ply p is stored at keyBase + p
+    U64 keyStack[FIFTY_MOVE_PLIES + MAX_PLY];
+    int keyBase = 0;
+};
+
+// Resizes the pool of search threads. The threads are started here and sleep between
+// searches, a search only wakes as many of them as it uses.
+void setSearchThreads(size_t count);
+
+// forgets the history and the cached evaluations of every thread, for a new game or network
+void clearSearchThreads();
+
+// searches until one of the limits runs out and prints the best move,
+// returns the number of nodes searched
+size_t search(ChessBoard &board, const SearchLimits &limits, size_t numThreads);
+
+// runs search() on the first pool thread so the uci loop keeps reading input,
+// a search that is still running is stopped first
+void startSearch(const ChessBoard &board, const SearchLimits &limits, size_t numThreads);
+
+// stops the background search and waits until it printed its bestmove
+void stopSearch();
+
+// the opponent played the ponder move, switch the running search over to our clock
+void ponderHit();
 
 bool kingInCheck(ChessBoard &board);
 
-void addToRepititon(ChessBoard &board, uint32_t move);
+// records the position for repetition detection and plays the move, used for the moves of "position"
+void addToRepetition(ChessBoard &board, uint32_t move);
+
+void clearRepetitions();
 
 #endif
\ No newline at end of file
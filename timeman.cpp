@@ -0,0 +1,41 @@
+#include "timeman.h"
+#include <algorithm>
+
+TimeBudget allocateTime(const SearchLimits &limits, bool white_to_move) {
+    TimeBudget budget;
+
+    if (limits.infinite) return budget;
+
+    // a fixed time per move uses all of it
+    if (limits.movetime >= 0) {
+        budget.hard = std::max<int64_t>(1, limits.movetime - MOVE_OVERHEAD_MS);
+        budget.soft = budget.hard;
+        budget.fixed = true;
+        return budget;
+    }
+
+    int64_t time = white_to_move ? limits.wtime : limits.btime;
+    int64_t inc = white_to_move ? limits.winc : limits.binc;
+    if (time < 0) return budget;
+
+    int64_t available = std::max<int64_t>(1, time - MOVE_OVERHEAD_MS);
+    int movesToGo = limits.movestogo > 0 ? std::min(limits.movestogo, 50) : DEFAULT_MOVES_TO_GO;
+
+    // spend an even share of the clock plus most of the increment, an unstable
+    // iteration may run up to 4 times over but never past half of what is left
+    budget.soft = std::min(available, available / movesToGo + inc * 3 / 4);
+    budget.hard = std::min(available / 2 + inc / 2, budget.soft * 4);
+    budget.hard = std::max<int64_t>(1, std::min(budget.hard, available));
+    budget.soft = std::max<int64_t>(1, std::min(budget.soft, budget.hard));
+
+    return budget;
+}
+
+bool shouldStartIteration(const TimeBudget &budget, int64_t elapsed, int64_t lastIteration) {
+    if (budget.soft == 0) return true;
+    if (elapsed >= budget.soft) return false;
+    if (budget.fixed) return true;
+
+    // the next iteration would be cut off by the hard limit, do not waste the time on it
+    return elapsed + lastIteration * 2 < budget.hard;
+}
@@ -0,0 +1,44 @@
+#ifndef TIMEMAN_H
+#define TIMEMAN_H
+
+#include <cstddef>
+#include <cstdint>
+
+// the clock is only read once every this many nodes per thread, must be a power of two
+constexpr size_t TIME_CHECK_INTERVAL = 2048;
+
+// time kept back on every move for gui and process latency
+constexpr int64_t MOVE_OVERHEAD_MS = 30;
+
+// moves we budget for when the gui does not send movestogo
+constexpr int DEFAULT_MOVES_TO_GO = 30;
+
+// everything a "go" command can limit the search by, -1 / 0 means not given
+struct SearchLimits {
+    int depth = -1;
+    int64_t movetime = -1;
+    int64_t wtime = -1;
+    int64_t btime = -1;
+    int64_t winc = 0;
+    int64_t binc = 0;
+    int movestogo = 0;
+    size_t nodes = 0;
+    bool infinite = false;
+    bool ponder = false;
+};
+
+// Soft limit: no new iteration is started past it. Hard limit: the running search is aborted.
+// Both are in milliseconds since the search started, 0 means no limit.
+struct TimeBudget {
+    int64_t soft = 0;
+    int64_t hard = 0;
+    bool fixed = false; // movetime, iterations keep starting until the hard limit aborts one
+};
+
+TimeBudget allocateTime(const SearchLimits &limits, bool white_to_move);
+
+// true when another iteration is worth starting, the next one is assumed to take
+// about twice as long as the last, a fixed budget starts one whenever time is left
+bool shouldStartIteration(const TimeBudget &budget, int64_t elapsed, int64_t lastIteration);
+
+#endif
@@ -1,19 +1,142 @@
 #include "transposition_table.h"
 
-void TranspositionTable::addTranspositionTableEntry(uint64_t hash, int depth, int value, uint32_t best_move, bool cut) {
-    TTEntry entry = {hash, depth, value, best_move, cut};
-    transposition_table[hash % TRANSPOSITION_TABLE_SIZE].store(entry, std::memory_order_relaxed);
+TranspositionTable transpositionTable;
+
+// layout of the packed data word
+// bits  0-26  best move
+// bits 27-47  value (offset so it is always positive)
+// bits 48-54  depth
+// bits 55-56  bound
+// bits 57-62  age
+constexpr int TT_VALUE_SHIFT = 27;
+constexpr int TT_DEPTH_SHIFT = 48;
+constexpr int TT_BOUND_SHIFT = 55;
+constexpr int TT_AGE_SHIFT = 57;
+constexpr int64_t TT_VALUE_OFFSET = 1 << 20;
+constexpr uint8_t TT_AGE_MASK = 0x3F;
+
+static uint64_t packData(int depth, int value, uint32_t move, uint8_t bound, uint8_t age) {
+    return (static_cast<uint64_t>(move) & 0x7FFFFFF) |
+           (static_cast<uint64_t>(value + TT_VALUE_OFFSET) & 0x1FFFFF) << TT_VALUE_SHIFT |
+           (static_cast<uint64_t>(depth) & 0x7F) << TT_DEPTH_SHIFT |
+           (static_cast<uint64_t>(bound) & 0x3) << TT_BOUND_SHIFT |
+           (static_cast<uint64_t>(age) & TT_AGE_MASK) << TT_AGE_SHIFT;
+}
+
+static int dataDepth(uint64_t data) {
+    return (data >> TT_DEPTH_SHIFT) & 0x7F;
+}
+
+static uint8_t dataBound(uint64_t data) {
+    return (data >> TT_BOUND_SHIFT) & 0x3;
+}
+
+static uint8_t dataAge(uint64_t data) {
+    return (data >> TT_AGE_SHIFT) & TT_AGE_MASK;
+}
+
+TranspositionTable::TranspositionTable(size_t megabytes) {
+    resize(megabytes);
+}
+
+TranspositionTable::~TranspositionTable() {
+    delete[] buckets;
+}
+
+void TranspositionTable::resize(size_t megabytes) {
+    if (megabytes < 1) megabytes = 1;
+    if (megabytes > TT_MAX_MB) megabytes = TT_MAX_MB;
+
+    delete[] buckets;
+    bucketCount = (megabytes * 1024 * 1024) / sizeof(TTBucket);
+    buckets = new TTBucket[bucketCount];
+    clear();
 }
 
 void TranspositionTable::clear() {
+    for (size_t i = 0; i < bucketCount; i++) {
+        for (TTSlot &slot : buckets[i].slots) {
+            slot.key.store(0, std::memory_order_relaxed);
+            slot.data.store(0, std::memory_order_relaxed);
+        }
+    }
+    age = 0;
+}
 
+void TranspositionTable::newSearch() {
+    age = (age + 1) & TT_AGE_MASK;
+}
+
+TTBucket &TranspositionTable::bucketFor(uint64_t hash) {
+    // map the hash onto [0, bucketCount) without needing a power of two size
+    return buckets[static_cast<size_t>((static_cast<unsigned __int128>(hash) * bucketCount) >> 64)];
+}
+
+void TranspositionTable::addTranspositionTableEntry(uint64_t hash, int depth, int value, uint32_t best_move, uint8_t bound) {
+    TTBucket &bucket = bucketFor(hash);
+
+    TTSlot *replace = nullptr;
+    int worstScore = INT32_MAX;
+
+    for (TTSlot &slot : bucket.slots) {
+        uint64_t data = slot.data.load(std::memory_order_relaxed);
+        uint64_t key = slot.key.load(std::memory_order_relaxed) ^ data;
+
+        if (key == hash && dataBound(data) != TT_NONE) {
+            // same position, keep a deeper result from this search unless we have an exact score
+            if (bound != TT_EXACT && dataAge(data) == age && depth + 2 < dataDepth(data)) {
+                return;
+            }
+            // keep the old move if we did not find one this time
+            if (best_move == 0) {
+                best_move = data & 0x7FFFFFF;
+            }
+            replace = &slot;
+            break;
+        }
+
+        // empty slots are always taken first, then the shallowest and oldest entry
+        int score = dataBound(data) == TT_NONE ? INT32_MIN : dataDepth(data) - 8 * ((age - dataAge(data)) & TT_AGE_MASK);
+        if (score < worstScore) {
+            worstScore = score;
+            replace = &slot;
+        }
+    }
+
+    uint64_t data = packData(depth, value, best_move, bound, age);
+    replace->key.store(hash ^ data, std::memory_order_relaxed);
+    replace->data.store(data, std::memory_order_relaxed);
 }
 
 std::optional<TTEntry> TranspositionTable::probeTranspositionTable(uint64_t hash) {
-    TTEntry entry = transposition_table[hash % TRANSPOSITION_TABLE_SIZE].load(std::memory_order_relaxed);
-    if (entry.hash == hash) {
-        return entry;
-    } else {
-        return std::nullopt;
+    TTBucket &bucket = bucketFor(hash);
+
+    for (TTSlot &slot : bucket.slots) {
+        uint64_t data = slot.data.load(std::memory_order_relaxed);
+        uint64_t key = slot.key.load(std::memory_order_relaxed) ^ data;
+
+        if (key == hash && dataBound(data) != TT_NONE) {
+            return TTEntry{
+                dataDepth(data),
+                static_cast<int>(static_cast<int64_t>((data >> TT_VALUE_SHIFT) & 0x1FFFFF) - TT_VALUE_OFFSET),
+                static_cast<uint32_t>(data & 0x7FFFFFF),
+                dataBound(data)
+            };
+        }
+    }
+
+    return std::nullopt;
+}
+
+int TranspositionTable::hashfull() const {
+    int used = 0;
+    size_t sampled = std::min<size_t>(1000 / TT_BUCKET_SIZE, bucketCount);
+
+    for (size_t i = 0; i < sampled; i++) {
+        for (const TTSlot &slot : buckets[i].slots) {
+            uint64_t data = slot.data.load(std::memory_order_relaxed);
+            if (dataBound(data) != TT_NONE && dataAge(data) == age) used++;
+        }
     }
+    return sampled ? used * 1000 / static_cast<int>(sampled * TT_BUCKET_SIZE) : 0;
 }
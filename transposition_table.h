@@ -2,29 +2,70 @@
 #define TRANSPOSITION_TABLE_H
 
 
+#include <algorithm>
 #include <cstdint>
-#include <iostream>
+#include <cstddef>
+#include <atomic>
+#include <optional>
 
+// type of bound the stored value represents, TT_NONE marks an empty slot
+enum {TT_NONE, TT_EXACT, TT_LOWER, TT_UPPER};
+
+// decoded entry handed back to the search
 struct TTEntry {
-    uint64_t hash;
     int depth;
     int value;
     uint32_t move;
-    bool cut;
+    uint8_t bound;
+};
+
+// A single slot is two 64 bit words so every load/store is lock free.
+// The key is stored xor'd with the data, if another thread tears the write
+// the key will not verify and the slot is treated as a miss.
+struct TTSlot {
+    std::atomic<uint64_t> key;
+    std::atomic<uint64_t> data;
+};
+
+constexpr size_t TT_BUCKET_SIZE = 4;
+constexpr size_t TT_DEFAULT_MB = 64;
+constexpr size_t TT_MAX_MB = 4096;
+
+// 4 slots of 16 bytes fill exactly one cache line
+struct alignas(64) TTBucket {
+    TTSlot slots[TT_BUCKET_SIZE];
 };
 
 class TranspositionTable {
     public:
-        void addTranspositionTableEntry(uint64_t hash, int depth, int value, uint32_t best_move, bool cut);
-        // Add an entry to the transposition table.
+        TranspositionTable(size_t megabytes = TT_DEFAULT_MB);
+        ~TranspositionTable();
+
+        // reallocate the table, this also clears it
+        void resize(size_t megabytes);
+
         void clear();
 
+        // bump the age so entries from older searches get replaced first
+        void newSearch();
+
+        // Add an entry to the transposition table.
+        void addTranspositionTableEntry(uint64_t hash, int depth, int value, uint32_t best_move, uint8_t bound);
+
         std::optional<TTEntry> probeTranspositionTable(uint64_t hash);
 
+        // permille of the first thousand slots holding an entry from this search, for uci hashfull
+        int hashfull() const;
+
     private:
-        // Declare the fixed size transposition table as an array
-        static const size_t TRANSPOSITION_TABLE_SIZE = 1 << 20; // 1 million entries
-        std::array<std::atomic<TTEntry>, TRANSPOSITION_TABLE_SIZE> transposition_table;
+        TTBucket *buckets = nullptr;
+        size_t bucketCount = 0;
+        uint8_t age = 0;
+
+        TTBucket &bucketFor(uint64_t hash);
 };
 
-#endif
\ No newline at end of file
+// the one table shared by every search thread
+extern TranspositionTable transpositionTable;
+
+#endif
@@ -1,7 +1,42 @@
 #include "uci.h"
 
-int main() {
-    clearLogs();
+int main(int argc, char *argv[]) {
+    startLogger();
+
+    // the tables are built in the background while the gui starts up and sends its
+    // first command, anything that needs them waits for the builder
+    std::thread tableBuilder(initEngine);
+    if (argc >= 2) {
+        tableBuilder.join();
+    }
+
+    // command line nnue check: bench nnue [depth]
+    if (argc >= 3 && std::string(argv[1]) == "bench" && std::string(argv[2]) == "nnue") {
+        bool passed = nnueCheck(argc >= 4 ? std::stoi(argv[3]) : NNUE_CHECK_DEFAULT_DEPTH);
+        return passed ? 0 : 1;
+    }
+
+    // command line bench: bench [depth]
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        bench(argc >= 3 ? std::stoi(argv[2]) : BENCH_DEFAULT_DEPTH);
+        return 0;
+    }
+
+    // command line perft suite: perft suite <file> [max depth]
+    if (argc >= 4 && std::string(argv[1]) == "perft" && std::string(argv[2]) == "suite") {
+        bool passed = perftSuite(argv[3], argc >= 5 ? std::stoi(argv[4]) : 0, std::thread::hardware_concurrency());
+        return passed ? 0 : 1;
+    }
+
+    // command line perft, used by run-perft.sh: <depth> <fen> [moves]
+    if (argc >= 3) {
+        ChessBoard board = createBoardFromFen(argv[2]);
+        if (argc >= 4) {
+            parseMoves(board, argv[3]);
+        }
+        perft(board, std::stoi(argv[1]), std::thread::hardware_concurrency());
+        return 0;
+    }
 
     // ChessBoard board_ = createBoardFromFen("k2p4/1p4p1/p7/2n5/8/B7/8/3R2RK w - - 0 1");
     // ChessBoard board_ = createBoardFromFen("8/k2r4/p7/2b1Bp2/P3p3/qp4R1/4QP2/1K6 b - - 0 1");
@@ -14,7 +49,14 @@ int main() {
 
     std::string line;
     ChessBoard board;
+    size_t numThreads = 2;
     while (std::getline(std::cin, line)) {
+        if (tableBuilder.joinable()) {
+            tableBuilder.join();
+            board = createBoardFromFen(STARTING_FEN);
+            setSearchThreads(numThreads);
+        }
+
         std::istringstream iss(line);
         std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
                                         std::istream_iterator<std::string>{}};
@@ -28,68 +70,189 @@ int main() {
             std::cout << "id author Jeremy Colegrove" << std::endl;
 
             // print the available options here
-            // for example: "option name Hash type spin default 1 min 1 max 1024"
+            std::cout << "option name Hash type spin default " << TT_DEFAULT_MB << " min 1 max " << TT_MAX_MB << std::endl;
             std::cout << "option name Threads type spin default 2 min 1 max 32" << std::endl;
+            std::cout << "option name Ponder type check default false" << std::endl;
+            std::cout << "option name NullMove type check default true" << std::endl;
+            std::cout << "option name LMR type check default true" << std::endl;
+            std::cout << "option name ReverseFutility type check default true" << std::endl;
+            std::cout << "option name Futility type check default true" << std::endl;
+            std::cout << "option name CheckExtensions type check default true" << std::endl;
+            std::cout << "option name UseNNUE type check default false" << std::endl;
+            std::cout << "option name EvalFile type string default <empty>" << std::endl;
+            std::cout << "option name PEXT type check default " << (hasFastPext() ? "true" : "false") << std::endl;
+            std::cout << "option name LogFile type string default " << LOG_DEFAULT_FILE << std::endl;
+            std::cout << "option name LogMaxSize type spin default " << LOG_DEFAULT_MAX_KB << " min 0 max 1048576" << std::endl;
+            std::cout << "option name LogLevel type combo default info var debug var info var warning var error var off" << std::endl;
+            std::cout << "option name StatsFile type string default <empty>" << std::endl;
+            std::cout << "option name EvalCache type spin default " << EVAL_CACHE_DEFAULT_MB << " min 0 max " << EVAL_CACHE_MAX_MB << std::endl;
             std::cout << "uciok" << std::endl;
         } else if (tokens[0] == "isready") {
             std::cout << "readyok" << std::endl;
         } else if (tokens[0] == "ucinewgame") {
+            stopSearch();
+            clearRepetitions();
+            clearSearchThreads();
             board = createBoardFromFen(STARTING_FEN);
+            transpositionTable.clear();
         } else if (tokens[0] == "position") {
             // process the position command
             // "position startpos moves e2e4 e7e5"
             // or: "position fen rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves e2e4 e7e5"
-            int movesIndex = -1;
-            if (tokens[1] == "startpos") {
+            size_t movesIndex = tokens.size();
+            clearRepetitions();
+            if (tokens.size() > 1 && tokens[1] == "startpos") {
                 board = createBoardFromFen(STARTING_FEN);
                 movesIndex = 2;
-            } else if (tokens[1] == "fen") {
+            } else if (tokens.size() > 1 && tokens[1] == "fen") {
                 std::string fen;
-                int i = 2;
-                while (tokens[i] != "moves" && i < tokens.size()) {
+                size_t i = 2;
+                while (i < tokens.size() && tokens[i] != "moves") {
                     fen += tokens[i++] + " ";
-                    movesIndex = i;
                 }
+                movesIndex = i;
                 board = createBoardFromFen(fen);
             }
 
-            if (tokens[movesIndex] == "moves") {
-                for (int i = movesIndex + 1; i < tokens.size(); ++i) {
-                    // Make the move on the board
-                    makeMove(board, parseMove(board, tokens[i]));
+            if (movesIndex < tokens.size() && tokens[movesIndex] == "moves") {
+                for (size_t i = movesIndex + 1; i < tokens.size(); ++i) {
+                    uint32_t move = parseMove(board, tokens[i]);
+                    if (!move) {
+                        std::cout << "info string illegal move " << tokens[i] << ", ignoring the rest" << std::endl;
+                        break;
+                    }
+                    // Make the move on the board, keeping the positions for repetition detection
+                    addToRepetition(board, move);
                 }
             }
+        } else if (tokens[0] == "stop") {
+            stopSearch();
+        } else if (tokens[0] == "ponderhit") {
+            ponderHit();
+        } else if (tokens[0] == "bench") {
+            stopSearch();
+            // bench [depth], bench nodes <count> or bench nnue [depth]
+            if (tokens.size() > 1 && tokens[1] == "nnue") {
+                nnueCheck(tokens.size() > 2 ? std::stoi(tokens[2]) : NNUE_CHECK_DEFAULT_DEPTH);
+            } else if (tokens.size() > 2 && tokens[1] == "nodes") {
+                bench(BENCH_DEFAULT_DEPTH, std::stoull(tokens[2]));
+            } else {
+                bench(tokens.size() > 1 ? std::stoi(tokens[1]) : BENCH_DEFAULT_DEPTH);
+            }
+        } else if (tokens[0] == "perft" && tokens.size() > 2 && tokens[1] == "suite") {
+            stopSearch();
+            perftSuite(tokens[2], tokens.size() > 3 ? std::stoi(tokens[3]) : 0, std::thread::hardware_concurrency());
+        } else if (tokens[0] == "go" && tokens.size() > 2 && tokens[1] == "perft") {
+            stopSearch();
+            perft(board, std::stoi(tokens[2]), std::thread::hardware_concurrency());
         } else if (tokens[0] == "go") {
-            int depth = -1, movetime = -1, nodes = -1;
-            bool infinite = false;
+            SearchLimits limits;
 
             for (size_t i = 1; i < tokens.size(); ++i) {
                 if (tokens[i] == "depth") {
-                    depth = std::stoi(tokens[++i]);
+                    limits.depth = std::stoi(tokens[++i]);
                 } else if (tokens[i] == "movetime") {
-                    movetime = std::stoi(tokens[++i]);
+                    limits.movetime = std::stoll(tokens[++i]);
                 } else if (tokens[i] == "nodes") {
-                    nodes = std::stoi(tokens[++i]);
+                    limits.nodes = std::stoull(tokens[++i]);
+                } else if (tokens[i] == "wtime") {
+                    limits.wtime = std::stoll(tokens[++i]);
+                } else if (tokens[i] == "btime") {
+                    limits.btime = std::stoll(tokens[++i]);
+                } else if (tokens[i] == "winc") {
+                    limits.winc = std::stoll(tokens[++i]);
+                } else if (tokens[i] == "binc") {
+                    limits.binc = std::stoll(tokens[++i]);
+                } else if (tokens[i] == "movestogo") {
+                    limits.movestogo = std::stoi(tokens[++i]);
                 } else if (tokens[i] == "infinite") {
-                    infinite = true;
+                    limits.infinite = true;
+                } else if (tokens[i] == "ponder") {
+                    limits.ponder = true;
                 }
             }
 
-            // just search with depth for now
-            search(board, depth, movetime, 2);
+            // the search runs in the background so stop and ponderhit are read while it thinks
+            startSearch(board, limits, numThreads);
         } else if (tokens[0] == "quit") {
             break;
         } else if (tokens[0] == "setoption") {
             std::string name, value;
-            for (int i = 1; i < tokens.size(); ++i) {
+            for (size_t i = 1; i < tokens.size(); ++i) {
                 if (tokens[i] == "name") {
                     name = tokens[++i];
                 } else if (tokens[i] == "value") {
+                    // the value is the rest of the line, file names may contain spaces
                     value = tokens[++i];
+                    while (i + 1 < tokens.size()) {
+                        value += " " + tokens[++i];
+                    }
                 }
             }
 
             // set option here with 'name' and 'token'
+            if (name == "Hash") {
+                stopSearch();
+                transpositionTable.resize(std::stoi(value));
+                logInfo("Hash set to", value, "MB");
+            } else if (name == "Threads") {
+                numThreads = std::clamp(std::stoi(value), 1, 32);
+                setSearchThreads(numThreads);
+                logInfo("Threads set to", numThreads);
+            } else if (name == "NullMove") {
+                stopSearch();
+                searchOptions.nullMove = value == "true";
+            } else if (name == "LMR") {
+                stopSearch();
+                searchOptions.lmr = value == "true";
+            } else if (name == "ReverseFutility") {
+                stopSearch();
+                searchOptions.reverseFutility = value == "true";
+            } else if (name == "Futility") {
+                stopSearch();
+                searchOptions.futility = value == "true";
+            } else if (name == "CheckExtensions") {
+                stopSearch();
+                searchOptions.extensions = value == "true";
+            } else if (name == "EvalFile") {
+                stopSearch();
+                if (!value.empty() && value != "<empty>" && !loadNetwork(value)) {
+                    std::cout << "info string unable to load network " << value << std::endl;
+                }
+                clearSearchThreads();
+            } else if (name == "UseNNUE") {
+                stopSearch();
+                useNNUE = value == "true";
+                if (useNNUE && !networkLoaded) {
+                    std::cout << "info string no network loaded, set EvalFile first" << std::endl;
+                }
+                clearSearchThreads();
+            } else if (name == "PEXT") {
+                stopSearch();
+                bool pext = setSliderIndexing(value == "true");
+                logInfo("Slider attacks indexed by", pext ? "pext" : "magics");
+            } else if (name == "LogFile") {
+                setLogFile(value);
+            } else if (name == "LogMaxSize") {
+                setLogMaxSize(std::stoul(value));
+            } else if (name == "LogLevel") {
+                if (!setLogLevel(value)) {
+                    std::cout << "info string unknown log level " << value << std::endl;
+                }
+            } else if (name == "StatsFile") {
+                stopSearch();
+                searchOptions.statsFile = value == "<empty>" ? "" : value;
+            } else if (name == "EvalCache") {
+                stopSearch();
+                searchOptions.evalCacheMB = std::clamp<size_t>(std::stoul(value), 0, EVAL_CACHE_MAX_MB);
+                logInfo("EvalCache set to", searchOptions.evalCacheMB, "MB");
+            }
         }
     }
+
+    // quit or end of input, a running search still has to print its bestmove
+    stopSearch();
+    if (tableBuilder.joinable()) {
+        tableBuilder.join();
+    }
 }
\ No newline at end of file
@@ -5,8 +5,11 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <iterator>
 #include "engine.h"
 #include "logger.h"
 #include "moves.h"
 #include "search.h"
+#include "transposition_table.h"
+#include "bench.h"
 #endif
\ No newline at end of file